@@ -167,16 +167,34 @@ static constexpr bool DUTY_CYCLES[4 * 8] = {
     true,  false, false, false, false, true,  true,  true,   // 50%
     false, true,  true,  true,  true,  true,  true,  false,  // 75%
 };
-void SquareChannel::emulate_clock() {
-    if (clockCnt > 0) {
-        clockCnt--;
-        if (clockCnt == 0) {
-            clockCnt = clockLen;
-            cycleIndex = (cycleIndex + 1) & 0x7;
-
-            outVol = enabled * dacEnabled * volumeEnvelope.get_volume() *
-                     DUTY_CYCLES[cycleIndex + dutyOff];
-        }
+void SquareChannel::advance(u32 clocks, u32 time, const ChannelOutput& output) {
+    if (clockCnt == 0) {
+        return;
+    }
+    if (clocks < clockCnt) {
+        clockCnt -= clocks;
+        return;
+    }
+    // First step on the clock the counter runs out, then one every clockLen clocks
+    clocks -= clockCnt;
+    time += clockCnt - 1u;
+    u32 numSteps = 1;
+    if (clockLen > 0) {
+        numSteps += clocks / clockLen;
+        clockCnt = clockLen - clocks % clockLen;
+    } else {
+        clockCnt = 0;
+    }
+
+    u8 volume = enabled * dacEnabled * volumeEnvelope.get_volume();
+    if (volume == 0) {
+        cycleIndex = (cycleIndex + numSteps) & 0x7;
+        output.set_level(outVol, 0, time);
+        return;
+    }
+    for (u32 i = 0; i < numSteps; i++, time += clockLen) {
+        cycleIndex = (cycleIndex + 1) & 0x7;
+        output.set_level(outVol, volume * DUTY_CYCLES[cycleIndex + dutyOff], time);
     }
 }
 
@@ -235,22 +253,39 @@ void WaveChannel::update_frequency() {
 
 void WaveChannel::emulate_length_clock() { lengthCounter.emulate_clock(); }
 
-void WaveChannel::emulate_clock() {
-    if (clockCnt > 0) {
-        clockCnt--;
-        if (clockCnt == 0) {
-            clockCnt = clockLen;
-            sampleIndex = (sampleIndex + 1) & 0x1F;
-
-            u8 sample;
-            if ((sampleIndex & 0x1) == 0) {
-                sample = samples[sampleIndex >> 1] >> 4;
-            } else {
-                sample = samples[sampleIndex >> 1] & 0xF;
-            }
+void WaveChannel::advance(u32 clocks, u32 time, const ChannelOutput& output) {
+    if (clockCnt == 0) {
+        return;
+    }
+    if (clocks < clockCnt) {
+        clockCnt -= clocks;
+        return;
+    }
+    clocks -= clockCnt;
+    time += clockCnt - 1u;
+    u32 numSteps = 1;
+    if (clockLen > 0) {
+        numSteps += clocks / clockLen;
+        clockCnt = clockLen - clocks % clockLen;
+    } else {
+        clockCnt = 0;
+    }
 
-            outVol = enabled * dacEnabled * (sample >> shiftVol);
+    if (!enabled || !dacEnabled || shiftVol > 2) {
+        sampleIndex = (sampleIndex + numSteps) & 0x1F;
+        output.set_level(outVol, 0, time);
+        return;
+    }
+    for (u32 i = 0; i < numSteps; i++, time += clockLen) {
+        sampleIndex = (sampleIndex + 1) & 0x1F;
+
+        u8 sample;
+        if ((sampleIndex & 0x1) == 0) {
+            sample = samples[sampleIndex >> 1] >> 4;
+        } else {
+            sample = samples[sampleIndex >> 1] & 0xF;
         }
+        output.set_level(outVol, sample >> shiftVol, time);
     }
 }
 
@@ -305,20 +340,32 @@ void NoiseChannel::emulate_length_clock() { lengthCounter.emulate_clock(); }
 
 void NoiseChannel::emulate_volume_clock() { volumeEnvelope.emulate_clock(); }
 
-void NoiseChannel::emulate_clock() {
-    if (clockEnabled && clockCnt > 0) {
-        clockCnt--;
-        if (clockCnt == 0) {
-            clockCnt = clockLen;
-
-            bool res = ((lsfr >> 1) ^ lsfr) & 0x1;
-            lsfr = (res << 14) | ((lsfr >> 1) & 0x3FFF);
-            if (widthMode) {
-                lsfr = (lsfr & 0xFFBF) | (res << 6);
-            }
+void NoiseChannel::advance(u32 clocks, u32 time, const ChannelOutput& output) {
+    if (!clockEnabled || clockCnt == 0) {
+        return;
+    }
+    if (clocks < clockCnt) {
+        clockCnt -= clocks;
+        return;
+    }
+    clocks -= clockCnt;
+    time += clockCnt - 1u;
+    u32 numSteps = 1;
+    if (clockLen > 0) {
+        numSteps += clocks / clockLen;
+        clockCnt = clockLen - clocks % clockLen;
+    } else {
+        clockCnt = 0;
+    }
 
-            outVol = enabled * dacEnabled * volumeEnvelope.get_volume() * ((lsfr & 0x1) == 0);
+    u8 volume = enabled * dacEnabled * volumeEnvelope.get_volume();
+    for (u32 i = 0; i < numSteps; i++, time += clockLen) {
+        bool res = ((lsfr >> 1) ^ lsfr) & 0x1;
+        lsfr = (res << 14) | ((lsfr >> 1) & 0x3FFF);
+        if (widthMode) {
+            lsfr = (lsfr & 0xFFBF) | (res << 6);
         }
+        output.set_level(outVol, volume * ((lsfr & 0x1) == 0), time);
     }
 }
 
@@ -334,6 +381,8 @@ APU::APU(Memory& memory) : memory(&memory) {
     wave.set_samples(&memory.ref(IOReg::WAVE_TABLE_START_REG));
 }
 
+constexpr double CLOCKS_PER_SAMPLE =
+    PPU::TOTAL_CLOCKS / (Constants::SAMPLE_RATE / (1000.0 / Constants::MS_PER_FRAME));
 void APU::restart() {
     square1.restart();
     square2.restart();
@@ -344,68 +393,111 @@ void APU::restart() {
     square1.boot_length_counter();
 
     frameSequenceClocks = 0;
-    downSampleCnt = 0;
+
+    frameClocks = 0;
+    leftBuffer.restart(CLOCKS_PER_SAMPLE);
+    rightBuffer.restart(CLOCKS_PER_SAMPLE);
 
     isPowerOn = true;
+    update_output(0, 0);
+}
+
+void APU::end_frame() {
+    memory->sync_apu();
+    leftBuffer.end_frame(frameClocks);
+    rightBuffer.end_frame(frameClocks);
+    frameClocks = 0;
 }
 
 void APU::sample(s16* sampleBuffer, u16 sampleLen) {
-    for (int i = 0; i < sampleLen; i += 2) {
-        if (sampleQueue.size == 0) break;
-        sampleBuffer[i] = sampleQueue.dequeue();
-        sampleBuffer[i + 1] = sampleQueue.dequeue();
+    u32 count = leftBuffer.get_samples_avail();
+    if (count > sampleLen / 2u) {
+        count = sampleLen / 2u;
     }
+    leftBuffer.read_samples(sampleBuffer, count, 2);
+    rightBuffer.read_samples(sampleBuffer + 1, count, 2);
 }
 
-constexpr double CLOCKS_PER_SAMPLE =
-    PPU::TOTAL_CLOCKS / (Constants::SAMPLE_RATE / (1000.0 / Constants::MS_PER_FRAME));
-void APU::emulate_clock() {
-    if (!isPowerOn) {
-        return;
-    }
-    frameSequenceClocks++;
-    if (frameSequenceClocks == 8192) {
-        frameSequenceClocks = 0;
-        if ((frameSequenceStep & 0x1) == 0x0) {
-            square1.emulate_length_clock();
-            square2.emulate_length_clock();
-            wave.emulate_length_clock();
-            noise.emulate_length_clock();
-        }
-        if ((frameSequenceStep & 0x3) == 0x2) {
-            square1.emulate_sweep_clock();
-        }
-        if (frameSequenceStep == 0x7) {
-            square1.emulate_volume_clock();
-            square2.emulate_volume_clock();
-            noise.emulate_volume_clock();
+void APU::emulate_clocks(u32 numClocks) {
+    if (isPowerOn) {
+        // The frame sequencer steps before the channels are clocked on every 8192th clock
+        u32 channelClocks = 0;
+        u32 sequencerClocks = 8192u - frameSequenceClocks;
+        while (sequencerClocks <= numClocks) {
+            advance_channels(sequencerClocks - 1 - channelClocks, frameClocks + channelClocks);
+            channelClocks = sequencerClocks - 1;
+            emulate_frame_sequencer();
+            sequencerClocks += 8192;
         }
-        frameSequenceStep = (frameSequenceStep + 1) & 0x7;
+        advance_channels(numClocks - channelClocks, frameClocks + channelClocks);
+        frameSequenceClocks = (u16)(8192 - (sequencerClocks - numClocks));
     }
+    frameClocks += numClocks;
+}
 
-    square1.emulate_clock();
-    square2.emulate_clock();
-    wave.emulate_clock();
-    noise.emulate_clock();
+void APU::emulate_frame_sequencer() {
+    if ((frameSequenceStep & 0x1) == 0x0) {
+        square1.emulate_length_clock();
+        square2.emulate_length_clock();
+        wave.emulate_length_clock();
+        noise.emulate_length_clock();
+    }
+    if ((frameSequenceStep & 0x3) == 0x2) {
+        square1.emulate_sweep_clock();
+    }
+    if (frameSequenceStep == 0x7) {
+        square1.emulate_volume_clock();
+        square2.emulate_volume_clock();
+        noise.emulate_volume_clock();
+    }
+    frameSequenceStep = (frameSequenceStep + 1) & 0x7;
+}
 
-    if (downSampleCnt >= CLOCKS_PER_SAMPLE) {
-        downSampleCnt -= CLOCKS_PER_SAMPLE;
+void APU::advance_channels(u32 clocks, u32 time) {
+    if (clocks == 0) {
+        return;
+    }
+    square1.advance(clocks, time, get_output(square1.leftEnable, square1.rightEnable));
+    square2.advance(clocks, time, get_output(square2.leftEnable, square2.rightEnable));
+    wave.advance(clocks, time, get_output(wave.leftEnable, wave.rightEnable));
+    noise.advance(clocks, time, get_output(noise.leftEnable, noise.rightEnable));
+}
 
-        u16 mixedLeftVol = 0;
-        mixedLeftVol += square1.get_left_vol();
-        mixedLeftVol += square2.get_left_vol();
-        mixedLeftVol += wave.get_left_vol();
-        mixedLeftVol += noise.get_left_vol();
-        sampleQueue.enqueue((s16)(Constants::MASTER_VOLUME * mixedLeftVol * leftVol));
+// Volume levels are multiples of 16, so the mixed levels are the sum of each scaled channel level
+ChannelOutput APU::get_output(bool leftEnable, bool rightEnable) {
+    s32 leftScale = (s32)(Constants::MASTER_VOLUME * leftVol);
+    s32 rightScale = (s32)(Constants::MASTER_VOLUME * rightVol);
+    return {&leftBuffer, &rightBuffer, leftEnable * leftScale, rightEnable * rightScale};
+}
 
-        u16 mixedRightVol = 0;
-        mixedRightVol += square1.get_right_vol();
-        mixedRightVol += square2.get_right_vol();
-        mixedRightVol += wave.get_right_vol();
-        mixedRightVol += noise.get_right_vol();
-        sampleQueue.enqueue((s16)(Constants::MASTER_VOLUME * mixedRightVol * rightVol));
+s32 APU::get_left_level() {
+    u16 mixedLeftVol = 0;
+    mixedLeftVol += square1.get_left_vol();
+    mixedLeftVol += square2.get_left_vol();
+    mixedLeftVol += wave.get_left_vol();
+    mixedLeftVol += noise.get_left_vol();
+    return (s32)(Constants::MASTER_VOLUME * mixedLeftVol * leftVol);
+}
+
+s32 APU::get_right_level() {
+    u16 mixedRightVol = 0;
+    mixedRightVol += square1.get_right_vol();
+    mixedRightVol += square2.get_right_vol();
+    mixedRightVol += wave.get_right_vol();
+    mixedRightVol += noise.get_right_vol();
+    return (s32)(Constants::MASTER_VOLUME * mixedRightVol * rightVol);
+}
+
+// Adds the change of the mixed output levels after a change to the volume or panning
+void APU::update_output(s32 prevLeftLevel, s32 prevRightLevel) {
+    s32 left = get_left_level();
+    if (left != prevLeftLevel) {
+        leftBuffer.add_delta(frameClocks, left - prevLeftLevel);
+    }
+    s32 right = get_right_level();
+    if (right != prevRightLevel) {
+        rightBuffer.add_delta(frameClocks, right - prevRightLevel);
     }
-    downSampleCnt++;
 }
 
 static constexpr u8 REGISTER_MASK[5 * 4] = {
@@ -433,6 +525,8 @@ void APU::write_register(u8 ioReg, u8 val) {
     if (ioReg == 0x26) {
         isPowerOn = val & 0x80;
         if (!isPowerOn) {
+            s32 prevLeftLevel = get_left_level();
+            s32 prevRightLevel = get_right_level();
             for (int i = 0xFF10; i <= 0xFF25; i++) {
                 memory->write(i, 0);
             }
@@ -447,25 +541,30 @@ void APU::write_register(u8 ioReg, u8 val) {
             noise.leftEnable = noise.rightEnable = false;
 
             frameSequenceClocks = 0;
-            downSampleCnt = 0;
+            update_output(prevLeftLevel, prevRightLevel);
         }
     }
     if (!isPowerOn) {
         return;
     }
-    if (ioReg == 0x24) {
-        leftVol = (1 + ((val & 0x70) >> 4)) << 4;
-        rightVol = (1 + (val & 0x7)) << 4;
-    } else if (ioReg == 0x25) {
-        square1.leftEnable = val & 0x10;
-        square2.leftEnable = val & 0x20;
-        wave.leftEnable = val & 0x40;
-        noise.leftEnable = val & 0x80;
-
-        square1.rightEnable = val & 0x1;
-        square2.rightEnable = val & 0x2;
-        wave.rightEnable = val & 0x4;
-        noise.rightEnable = val & 0x8;
+    if (ioReg == 0x24 || ioReg == 0x25) {
+        s32 prevLeftLevel = get_left_level();
+        s32 prevRightLevel = get_right_level();
+        if (ioReg == 0x24) {
+            leftVol = (1 + ((val & 0x70) >> 4)) << 4;
+            rightVol = (1 + (val & 0x7)) << 4;
+        } else {
+            square1.leftEnable = val & 0x10;
+            square2.leftEnable = val & 0x20;
+            wave.leftEnable = val & 0x40;
+            noise.leftEnable = val & 0x80;
+
+            square1.rightEnable = val & 0x1;
+            square2.rightEnable = val & 0x2;
+            wave.rightEnable = val & 0x4;
+            noise.rightEnable = val & 0x8;
+        }
+        update_output(prevLeftLevel, prevRightLevel);
     } else {
         char channel = (ioReg - 0x10) / 5;
         char index = (ioReg - 0x10) % 5;
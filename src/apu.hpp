@@ -1,22 +1,24 @@
 #pragma once
 
+#include "blip_buffer.hpp"
 #include "general.hpp"
 
 class Memory;
 
-struct SampleQueue {
-    void enqueue(s16 val) { data[(offset + size++) % CAPACITY] = val; }
-    s16 dequeue() {
-        s16 val = data[offset];
-        offset = (offset + 1) % CAPACITY;
-        size--;
-        return val;
+// Adds a channel's output level changes to the buffers it is panned to
+struct ChannelOutput {
+    void set_level(u8& level, u8 newLevel, u32 clock) const {
+        if (newLevel != level) {
+            if (leftScale) left->add_delta(clock, (newLevel - level) * leftScale);
+            if (rightScale) right->add_delta(clock, (newLevel - level) * rightScale);
+            level = newLevel;
+        }
     }
 
-    static constexpr short CAPACITY = 4096;
-    u16 offset = 0;
-    u32 size = 0;
-    s16 data[CAPACITY];
+    BlipBuffer* left;
+    BlipBuffer* right;
+    s32 leftScale;
+    s32 rightScale;
 };
 
 template <int maxLoad>
@@ -71,7 +73,7 @@ public:
     void emulate_sweep_clock();
     void emulate_length_clock();
     void emulate_volume_clock();
-    void emulate_clock();
+    void advance(u32 clocks, u32 time, const ChannelOutput& output);
 
     void boot_length_counter();
     bool is_length_active();
@@ -118,7 +120,7 @@ public:
     void update_frequency();
 
     void emulate_length_clock();
-    void emulate_clock();
+    void advance(u32 clocks, u32 time, const ChannelOutput& output);
 
     bool is_length_active();
 
@@ -156,7 +158,7 @@ public:
 
     void emulate_length_clock();
     void emulate_volume_clock();
-    void emulate_clock();
+    void advance(u32 clocks, u32 time, const ChannelOutput& output);
 
     bool is_length_active();
 
@@ -187,8 +189,11 @@ class APU {
 public:
     APU(Memory& memory);
     void restart();
+    // Catches up and closes the buffered frame, called after every frame so the clock counters
+    // stay bounded even when no samples are read
+    void end_frame();
     void sample(s16* sampleBuffer, u16 sampleLen);
-    void emulate_clock();
+    void emulate_clocks(u32 numClocks);
 
     u8 read_register(u8 originalVal, u8 ioReg);
     void write_register(u8 ioReg, u8 val);
@@ -197,12 +202,23 @@ public:
     u8 read_pcm34();
 
 private:
+    void emulate_frame_sequencer();
+    void advance_channels(u32 clocks, u32 time);
+
+    ChannelOutput get_output(bool leftEnable, bool rightEnable);
+    s32 get_left_level();
+    s32 get_right_level();
+    void update_output(s32 prevLeftLevel, s32 prevRightLevel);
+
     Memory* memory;
 
-    short frameSequenceClocks;
+    u16 frameSequenceClocks;
     char frameSequenceStep;
-    double downSampleCnt;
-    SampleQueue sampleQueue;
+
+    // Output levels are added to the buffers as they change and read out once per frame
+    u32 frameClocks;
+    BlipBuffer leftBuffer;
+    BlipBuffer rightBuffer;
 
     SquareChannel square1;
     SquareChannel square2;
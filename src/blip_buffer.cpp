@@ -0,0 +1,97 @@
+#include "blip_buffer.hpp"
+
+#include <cmath>
+#include <cstring>
+
+namespace {
+constexpr int KERNEL_WIDTH = BlipBuffer::KERNEL_WIDTH;
+constexpr int PHASES = 1 << BlipBuffer::PHASE_BITS;
+constexpr int KERNEL_BITS = 15;
+
+// Windowed sinc impulses for each fractional sample offset, each summing to 1 << KERNEL_BITS so
+// the integrated step reaches the exact level
+struct Kernel {
+    Kernel() {
+        constexpr double PI = 3.14159265358979323846;
+        constexpr double CUTOFF = 0.9;
+        constexpr double HALF_WIDTH = KERNEL_WIDTH / 2;
+        for (int phase = 0; phase < PHASES; phase++) {
+            double impulse[KERNEL_WIDTH];
+            double sum = 0;
+            for (int i = 0; i < KERNEL_WIDTH; i++) {
+                double x = i - (HALF_WIDTH - 1) - (double)phase / PHASES;
+                double sinc = x == 0 ? 1 : std::sin(PI * CUTOFF * x) / (PI * CUTOFF * x);
+                double window = 0.42 + 0.5 * std::cos(PI * x / HALF_WIDTH) +
+                                0.08 * std::cos(2 * PI * x / HALF_WIDTH);
+                impulse[i] = sinc * window;
+                sum += impulse[i];
+            }
+            s32 total = 0;
+            for (int i = 0; i < KERNEL_WIDTH; i++) {
+                taps[phase][i] = (s32)std::lround(impulse[i] / sum * (1 << KERNEL_BITS));
+                total += taps[phase][i];
+            }
+            taps[phase][KERNEL_WIDTH / 2 - 1] += (1 << KERNEL_BITS) - total;
+        }
+    }
+    s32 taps[PHASES][KERNEL_WIDTH];
+};
+const Kernel KERNEL;
+}  // namespace
+
+void BlipBuffer::restart(double clocksPerSample) {
+    factor = (u64)((double)(1ULL << 32) / clocksPerSample);
+    offset = 0;
+    integrator = 0;
+    memset(deltas, 0, sizeof(deltas));
+}
+
+void BlipBuffer::add_delta(u32 clock, s32 delta) {
+    u64 pos = offset + clock * factor;
+    u64 index = pos >> 32;
+    if (index >= MAX_SAMPLES) {
+        // Samples weren't read for too long, the step still moves the level the later samples
+        // are integrated from
+        deltas[MAX_SAMPLES - 1] += (s64)delta << KERNEL_BITS;
+        return;
+    }
+    const s32* taps = KERNEL.taps[(pos >> (32 - PHASE_BITS)) & (PHASES - 1)];
+    s64* out = &deltas[index];
+    for (int i = 0; i < KERNEL_WIDTH; i++) {
+        out[i] += (s64)delta * taps[i];
+    }
+}
+
+void BlipBuffer::end_frame(u32 clocks) {
+    offset += clocks * factor;
+    u32 avail = get_samples_avail();
+    if (avail > MAX_SAMPLES) {
+        // Drop the oldest samples, keeping the level they end at
+        u32 excess = avail - MAX_SAMPLES;
+        for (u32 i = 0; i < excess && i < BUFFER_SIZE; i++) {
+            integrator += deltas[i];
+        }
+        remove_samples(excess);
+    }
+}
+
+void BlipBuffer::read_samples(s16* samples, u32 count, int stride) {
+    for (u32 i = 0; i < count; i++) {
+        integrator += deltas[i];
+        s64 sample = integrator >> KERNEL_BITS;
+        if (sample < INT16_MIN) sample = INT16_MIN;
+        if (sample > INT16_MAX) sample = INT16_MAX;
+        samples[i * (u32)stride] = (s16)sample;
+    }
+    remove_samples(count);
+}
+
+void BlipBuffer::remove_samples(u32 count) {
+    if (count < BUFFER_SIZE) {
+        memmove(deltas, deltas + count, (BUFFER_SIZE - count) * sizeof(s64));
+        memset(deltas + BUFFER_SIZE - count, 0, count * sizeof(s64));
+    } else {
+        memset(deltas, 0, sizeof(deltas));
+    }
+    offset -= (u64)count << 32;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "general.hpp"
+
+// Band limited synthesis buffer. Changes of the output level are added as band limited steps at
+// their clock timestamp and integrated into samples, so waves above the sample rate don't alias.
+class BlipBuffer {
+public:
+    static constexpr int KERNEL_WIDTH = 16;
+    static constexpr int PHASE_BITS = 6;
+    static constexpr u32 MAX_SAMPLES = 4096;
+
+    void restart(double clocksPerSample);
+
+    // Adds an output level change at the given clock, counted from the end of the last frame
+    void add_delta(u32 clock, s32 delta);
+
+    // Makes the samples before the given clock available and starts the next frame there
+    void end_frame(u32 clocks);
+
+    u32 get_samples_avail() { return (u32)(offset >> 32); }
+    void read_samples(s16* samples, u32 count, int stride);
+
+private:
+    void remove_samples(u32 count);
+
+    static constexpr u32 BUFFER_SIZE = MAX_SAMPLES + KERNEL_WIDTH;
+
+    u64 factor;  // samples per clock, 32.32 fixed point
+    u64 offset;  // sample position of the frame start, 32.32 fixed point
+    s64 integrator;
+    s64 deltas[BUFFER_SIZE];
+};
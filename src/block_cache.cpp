@@ -0,0 +1,160 @@
+#include "block_cache.hpp"
+
+#include "memory.hpp"
+
+namespace {
+// clang-format off
+constexpr u8 OP_LENGTHS[] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,  // 0x00
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,  // 0x10
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,  // 0x20
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,  // 0x30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xA0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xB0
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,  // 0xC0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,  // 0xD0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,  // 0xE0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,  // 0xF0
+};
+// clang-format on
+
+// Instructions after which the next PC isn't known when decoding
+bool ends_block(u8 opcode) {
+    if ((opcode & 0xC7) == 0xC7) {
+        return true;  // RST
+    }
+    switch (opcode) {
+        case 0x10:  // STOP
+        case 0x76:  // HALT
+        case 0x18:  // JR
+        case 0x20:
+        case 0x28:
+        case 0x30:
+        case 0x38:
+        case 0xC3:  // JP
+        case 0xC2:
+        case 0xCA:
+        case 0xD2:
+        case 0xDA:
+        case 0xE9:
+        case 0xCD:  // CALL
+        case 0xC4:
+        case 0xCC:
+        case 0xD4:
+        case 0xDC:
+        case 0xC9:  // RET
+        case 0xC0:
+        case 0xC8:
+        case 0xD0:
+        case 0xD8:
+        case 0xD9:
+        case 0xD3:  // Invalid opcodes
+        case 0xE3:
+        case 0xE4:
+        case 0xF4:
+        case 0xDB:
+        case 0xEB:
+        case 0xEC:
+        case 0xFC:
+        case 0xDD:
+        case 0xED:
+        case 0xFD:
+            return true;
+        default:
+            return false;
+    }
+}
+}  // namespace
+
+BlockCache::BlockCache(Memory& memory) : memory(&memory), blocks(new Block[NUM_BLOCKS]) {}
+
+void BlockCache::restart() {
+    for (size_t i = 0; i < NUM_BLOCKS; i++) {
+        blocks[i].host = nullptr;
+    }
+    curBlock = nullptr;
+    curOpIndex = 0;
+}
+
+u8 BlockCache::get_op_length(u8 opcode) { return OP_LENGTHS[opcode]; }
+
+const DecodedOp* BlockCache::fetch(u16 pc) {
+    const u8* page = memory->get_read_page(pc);
+    if (!page) {
+        return nullptr;
+    }
+    if (!curBlock || curOpIndex >= curBlock->numOps || curBlock->ops[curOpIndex].pc != pc ||
+        !is_valid(*curBlock, page)) {
+        curBlock = lookup(pc, page);
+        curOpIndex = 0;
+        if (!curBlock) {
+            return nullptr;
+        }
+    }
+    return &curBlock->ops[curOpIndex++];
+}
+
+bool BlockCache::is_valid(Block& block, const u8* page) {
+    if (block.page != page) {
+        return false;
+    }
+    return !block.inRam || block.writeCount == memory->get_write_count(block.ops[0].pc);
+}
+
+BlockCache::Block* BlockCache::lookup(u16 pc, const u8* page) {
+    // VRAM can become inaccessible in the middle of an instruction and echo ram writes are
+    // counted at their WRAM address, so code there is always fetched from memory
+    if ((0x8000 <= pc && pc < 0xA000) || pc >= 0xE000) {
+        return nullptr;
+    }
+
+    const u8* host = page + (pc & 0xFFF);
+    uintptr_t hostAddr = (uintptr_t)host;
+    Block& block = blocks[(hostAddr ^ (hostAddr >> 14)) & (NUM_BLOCKS - 1)];
+    if (block.host != host || block.ops[0].pc != pc || !is_valid(block, page)) {
+        decode(block, pc, page);
+    }
+    return block.numOps > 0 ? &block : nullptr;
+}
+
+void BlockCache::decode(Block& block, u16 pc, const u8* page) {
+    block.host = page + (pc & 0xFFF);
+    block.page = page;
+    block.inRam = pc >= 0x8000;
+    block.writeCount = memory->get_write_count(pc);
+    block.numOps = 0;
+
+    u16 addr = pc;
+    while (block.numOps < MAX_BLOCK_OPS) {
+        u8 opcode = page[addr & 0xFFF];
+        u8 length = OP_LENGTHS[opcode];
+        u16 lastAddr = addr + length - 1;
+        if ((addr >> 12) != (lastAddr >> 12)) {
+            break;  // Next page may be mapped elsewhere
+        }
+        if (block.inRam && (pc >> 8) != (lastAddr >> 8)) {
+            break;  // Ram blocks are validated by a single write counter
+        }
+
+        DecodedOp& op = block.ops[block.numOps++];
+        op.pc = addr;
+        op.opcode = opcode;
+        op.length = length;
+        op.imm[0] = length > 1 ? page[(addr + 1) & 0xFFF] : 0;
+        op.imm[1] = length > 2 ? page[(addr + 2) & 0xFFF] : 0;
+
+        addr += length;
+        if (ends_block(opcode)) {
+            break;
+        }
+    }
+    if (block.numOps == 0) {
+        block.host = nullptr;
+    }
+}
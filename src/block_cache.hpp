@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+
+#include "general.hpp"
+
+class Memory;
+
+struct DecodedOp {
+    u16 pc;
+    u8 opcode;
+    u8 length;  // opcode and immediate bytes
+    u8 imm[2];  // immediate bytes in fetch order, CB opcodes store the second opcode byte here
+};
+
+// Caches runs of decoded instructions up to the next control flow instruction. Blocks are keyed
+// by the host memory they were decoded from, so switching ROM or WRAM banks selects a different
+// block for the same PC. Blocks in RAM are dropped once their 256 byte chunk is written to.
+class BlockCache {
+public:
+    BlockCache(Memory& memory);
+    void restart();
+
+    // Returns the decoded instruction at pc or nullptr if it has to be fetched from memory
+    const DecodedOp* fetch(u16 pc);
+
+    // Opcode and immediate bytes of the instruction starting with opcode
+    static u8 get_op_length(u8 opcode);
+
+private:
+    static constexpr int MAX_BLOCK_OPS = 32;
+    struct Block {
+        const u8* host;  // host memory of the first instruction, nullptr if the block is empty
+        const u8* page;  // host memory mapped at the page of the block when it was decoded
+        bool inRam;
+        u32 writeCount;  // write count of the ram chunk containing the block
+        u8 numOps;
+        DecodedOp ops[MAX_BLOCK_OPS];
+    };
+
+    bool is_valid(Block& block, const u8* page);
+    Block* lookup(u16 pc, const u8* page);
+    void decode(Block& block, u16 pc, const u8* page);
+
+    Memory* memory;
+
+    static constexpr size_t NUM_BLOCKS = 0x1000;
+    std::unique_ptr<Block[]> blocks;
+
+    Block* curBlock;
+    u8 curOpIndex;
+};
@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 
+#include "scheduler.hpp"
+
 namespace {
 // clang-format off
 constexpr const char* ROM_SIZES[] = {
@@ -199,8 +201,14 @@ u8 Cartridge::read_ram(u16 addr) {
     return 0xFF;
 }
 
+u8* Cartridge::get_ram_bank() { return ramg ? *activeRamBank : nullptr; }
+
 void Cartridge::emulate_cycle() {}
 
+u32 Cartridge::get_idle_cycles() { return Scheduler::NEVER; }
+
+void Cartridge::skip_cycles(u32) {}
+
 ROMOnly::ROMOnly(CartridgeInfo& info, u8* rom) : Cartridge(info, "ROM Only", 2, 0, rom) {}
 
 void ROMOnly::write(u16 addr, u8 val) {
@@ -296,6 +304,9 @@ u8 MBC2::read_ram(u16 addr) {
     return 0xFF;
 }
 
+// MBC2 ram is only 512 half-bytes which are mirrored across the external ram region
+u8* MBC2::get_ram_bank() { return nullptr; }
+
 MBC3::MBC3(CartridgeInfo& info, u8* rom) : Cartridge(info, "MBC3", 256, 4, rom) {
     for (int i = 0; i < 5; i++) {
         // TODO keep track of the real time value in the save file
@@ -368,6 +379,13 @@ u8 MBC3::read_ram(u16 addr) {
     return 0xFF;
 }
 
+u8* MBC3::get_ram_bank() {
+    if (isTimerEnabled && isRTCSelected) {
+        return nullptr;
+    }
+    return Cartridge::get_ram_bank();
+}
+
 void MBC3::emulate_cycle() {
     if (rtcOn) {
         cycles++;
@@ -405,6 +423,19 @@ void MBC3::emulate_cycle() {
     }
 }
 
+u32 MBC3::get_idle_cycles() {
+    if (!rtcOn) {
+        return Scheduler::NEVER;
+    }
+    return cycles < CYCLES_PER_SECOND ? CYCLES_PER_SECOND - 1 - cycles : 0;
+}
+
+void MBC3::skip_cycles(u32 numCycles) {
+    if (rtcOn) {
+        cycles += numCycles;
+    }
+}
+
 MBC5::MBC5(CartridgeInfo& info, u8* rom) : Cartridge(info, "MBC5", 512, 16, rom) {}
 
 void MBC5::write(u16 addr, u8 val) {
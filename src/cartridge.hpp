@@ -25,7 +25,13 @@ public:
     u8 read_rom(u16 addr);
     virtual u8 read_ram(u16 addr);
 
+    u8* get_zero_bank() { return *zeroBank; }
+    u8* get_high_bank() { return *highBank; }
+    virtual u8* get_ram_bank();  // nullptr if external ram can't be accessed directly
+
     virtual void emulate_cycle();
+    virtual u32 get_idle_cycles();
+    virtual void skip_cycles(u32 numCycles);
 
     bool is_CGB() { return info.isCGB; }
     bool is_CGB_mode() { return info.isCGB && info.cgbMode; }
@@ -79,6 +85,7 @@ public:
     MBC2(CartridgeInfo& info, u8* rom);
     void write(u16 addr, u8 val) override;
     u8 read_ram(u16 addr) override;
+    u8* get_ram_bank() override;
 };
 
 class MBC3 : public Cartridge {
@@ -86,8 +93,11 @@ public:
     MBC3(CartridgeInfo& info, u8* rom);
     void write(u16 addr, u8 val) override;
     u8 read_ram(u16 addr) override;
+    u8* get_ram_bank() override;
 
     void emulate_cycle() override;
+    u32 get_idle_cycles() override;
+    void skip_cycles(u32 numCycles) override;
 
 private:
     bool isTimerEnabled;
@@ -111,7 +121,7 @@ private:
     Time latchedTime;
 
     static constexpr u32 CYCLES_PER_SECOND = 4194304 / 4;  // 4194304 clocks per second
-    u32 cycles;
+    u32 cycles = 0;
     Time realTime;
 
     bool rtcOn = false;
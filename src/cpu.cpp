@@ -1,6 +1,42 @@
 #include "cpu.hpp"
 
-CPU::CPU(Memory& memory) : memory(&memory) {}
+namespace {
+// Memory which only changes on scheduled events or writes by the cpu
+bool is_event_driven(u16 addr) {
+    if ((0xC000 <= addr && addr < 0xE000) || (0xFF80 <= addr && addr < 0xFFFF)) {
+        return true;  // WRAM and HRAM
+    }
+    switch (addr) {
+        case IOReg::SB_REG:
+        case IOReg::SC_REG:
+        case IOReg::TIMA_REG:
+        case IOReg::TMA_REG:
+        case IOReg::TAC_REG:
+        case IOReg::IF_REG:
+        case IOReg::LCDC_REG:
+        case IOReg::STAT_REG:
+        case IOReg::SCY_REG:
+        case IOReg::SCX_REG:
+        case IOReg::LY_REG:
+        case IOReg::LYC_REG:
+            return true;
+        default:
+            return false;
+    }
+}
+}  // namespace
+
+CPU::CPU(Memory& memory) : memory(&memory), blockCache(memory), recompiler(*this, memory) {}
+
+void CPU::set_backend(CPUBackend backend) {
+    if (backend == CPUBackend::RECOMPILER && !recompiler.init()) {
+        printf("Warning: Recompiler unavailable on this host, using the cached interpreter\n");
+        backend = CPUBackend::CACHED_INTERPRETER;
+    }
+    this->backend = backend;
+    blockCache.restart();
+    recompiler.restart();
+}
 
 void CPU::restart() {
     if (memory->is_CGB()) {
@@ -20,16 +56,22 @@ void CPU::restart() {
     imeScheduled = false;
     halted = false;
     haltBug = false;
+    flagOp = FlagOp::NONE;
+    lastLoop.pc = 0xFFFF;
+
+    blockCache.restart();
+    recompiler.restart();
+    immediates = nullptr;
 }
 
 void CPU::handle_interrupts() {
-    u8 ifReg = memory->read(IOReg::IF_REG);
-    u8 interrupts = ifReg & memory->read(IOReg::IE_REG) & 0x1F;
+    u8 interrupts = memory->get_pending_interrupts();
     if (interrupts) {
         // TODO only add extra cycle if emulating CGB
         // if (halted) cycleCnt++;  // Extra cycle if cpu is in halt mode
 
         if (ime) {
+            u8 ifReg = memory->get_interrupt_flags();
             for (int i = 0; i < 5; i++) {
                 if (interrupts & (1 << i)) {
                     ime = false;
@@ -39,7 +81,7 @@ void CPU::handle_interrupts() {
                     write(--SP, PC >> 8);
                     if (SP == 0xFFFF) {
                         u8 pushIE = PC >> 8;
-                        if ((ifReg & pushIE & 0x1F & (1 << i)) == 0) {
+                        if ((pushIE & (1 << i)) == 0) {
                             PC = 0x0000;
 #if LOG
                             printf("Info: ie push cancel ocurred\n");
@@ -65,14 +107,26 @@ void CPU::handle_interrupts() {
 }
 
 void CPU::fetch_execute() {
+    if (backend == CPUBackend::RECOMPILER && recompiler.run()) {
+        return;
+    }
     if (memory->is_speed_switching() || memory->is_hdma_ongoing()) {
         memory->sleep_cycle();
+        if (memory->is_speed_switching() || memory->is_hdma_ongoing()) {
+            skip_stalled_cycles();
+        }
         return;
     }
 
     memory->sleep_cycle();  // Sleep before handling interrupt to check for late interrupts
+    execute_fetched();
+}
+
+// Rest of an instruction once its opcode fetch cycle has passed
+void CPU::execute_fetched() {
     handle_interrupts();
     if (halted) {
+        skip_stalled_cycles();
         return;
     }
 
@@ -98,6 +152,19 @@ void CPU::fetch_execute() {
     if (debugger->is_paused()) {
         debugger->print_info();
     }
+    // Halt bug reads the opcode twice, so the instruction is fetched without the block cache.
+    // The recompiler also falls back to cached blocks.
+    const DecodedOp* decodedOp = nullptr;
+    if (backend != CPUBackend::INTERPRETER && !haltBug) {
+        decodedOp = blockCache.fetch(PC);
+    }
+    if (decodedOp) {
+        PC++;
+        immediates = decodedOp->imm;
+        execute(decodedOp->opcode);
+        immediates = nullptr;
+        return;
+    }
     u8 op = memory->read(PC++);  // Compensate for memory sleep earlier
     if (haltBug) {
         PC--;
@@ -106,6 +173,112 @@ void CPU::fetch_execute() {
     execute(op);
 }
 
+// Interrupts are only requested by scheduled events, so a stalled cpu can't resume before the
+// next event and the cycles in between are skipped together
+void CPU::skip_stalled_cycles() {
+    if (!debugger->is_paused()) {
+        memory->skip_cycles(memory->get_idle_cycles());
+    }
+}
+
+// Called at the end of a taken backward jump. If the loop didn't see any event since the last
+// iteration and ended up in the same state, it will keep doing so until the next event.
+void CPU::check_poll_loop(u16 jumpAddr) {
+    materialize_flags();
+    u64 cycle = memory->get_cycle();
+    u32 eventCycles = memory->get_event_cycles();
+    if (PC == lastLoop.pc && regs.A == lastLoop.A && regs.F == lastLoop.F &&
+        eventCycles == lastLoop.eventCycles && !imeScheduled && !debugger->is_paused()) {
+        // An interrupt handled during the iteration shows up as a longer iteration
+        u32 loopCycles = get_poll_loop_cycles(PC, jumpAddr);
+        if (loopCycles != 0 && cycle - lastLoop.cycle == loopCycles) {
+            u32 idleCycles = memory->get_idle_cycles();
+            u32 numCycles = idleCycles - idleCycles % loopCycles;
+            memory->skip_cycles(numCycles);
+            cycle += numCycles;
+        }
+    }
+    lastLoop.pc = PC;
+    lastLoop.A = regs.A;
+    lastLoop.F = regs.F;
+    lastLoop.cycle = cycle;
+    lastLoop.eventCycles = eventCycles;
+}
+
+// Returns the machine cycles of one iteration if the loop from start to the relative jump at
+// jumpAddr only modifies A and F and only reads event driven memory, 0 otherwise
+u32 CPU::get_poll_loop_cycles(u16 start, u16 jumpAddr) {
+    if (start > jumpAddr || (start >> 12) != (jumpAddr >> 12) ||
+        (0x8000 <= start && start < 0xA000) || start >= 0xE000) {
+        return 0;
+    }
+    const u8* page = memory->get_read_page(start);
+    if (!page) {
+        return 0;
+    }
+    u32 cycles = 3;  // Taken relative jump
+    u16 addr = start;
+    while (addr < jumpAddr) {
+        u8 opcode = page[addr & 0xFFF];
+        u8 imm0 = page[(addr + 1) & 0xFFF];
+        u8 imm1 = page[(addr + 2) & 0xFFF];
+        u16 readAddr = IOReg::DIV_REG;  // Any address which isn't event driven
+        u8 length = 1;
+        u8 opCycles = 1;
+        bool reads = false;
+        if (opcode == 0x00 || opcode == 0x07 || opcode == 0x0F || opcode == 0x17 ||
+            opcode == 0x1F || opcode == 0x2F || opcode == 0x37 || opcode == 0x3F ||
+            (0x78 <= opcode && opcode <= 0x7F && opcode != 0x7E) ||
+            (0x80 <= opcode && opcode <= 0xBF && (opcode & 0x7) != 0x6)) {
+            // NOP, rotate A, CPL, SCF, CCF, LD A, reg and ALU A, reg
+        } else if (opcode == 0x7E || (0x80 <= opcode && opcode <= 0xBF)) {
+            reads = true;  // LD A, (HL) and ALU A, (HL)
+            readAddr = regs.HL;
+            opCycles = 2;
+        } else if (opcode == 0x0A || opcode == 0x1A) {
+            reads = true;  // LD A, (BC) and LD A, (DE)
+            readAddr = opcode == 0x0A ? regs.BC : regs.DE;
+            opCycles = 2;
+        } else if (opcode == 0xF2) {
+            reads = true;  // LD A, (C)
+            readAddr = 0xFF00 + regs.C;
+            opCycles = 2;
+        } else if (opcode == 0xF0) {
+            reads = true;  // LD A, (n)
+            readAddr = 0xFF00 + imm0;
+            length = 2;
+            opCycles = 3;
+        } else if (opcode == 0xFA) {
+            reads = true;  // LD A, (nn)
+            readAddr = (u16)(imm0 | imm1 << 8);
+            length = 3;
+            opCycles = 4;
+        } else if ((opcode & 0xC7) == 0xC6) {
+            length = 2;  // ALU A, n
+            opCycles = 2;
+        } else if (opcode == 0xCB && (imm0 & 0xC0) == 0x40) {
+            length = 2;  // BIT b, reg
+            opCycles = 2;
+            if ((imm0 & 0x7) == 0x6) {
+                reads = true;
+                readAddr = regs.HL;
+                opCycles = 3;
+            }
+        } else if (opcode == 0xCB && (imm0 & 0x7) == 0x7) {
+            length = 2;  // Other CB operations on A
+            opCycles = 2;
+        } else {
+            return 0;
+        }
+        if (reads && !is_event_driven(readAddr)) {
+            return 0;
+        }
+        addr += length;
+        cycles += opCycles;
+    }
+    return addr == jumpAddr ? cycles : 0;
+}
+
 // clang-format off
 void CPU::execute(u8 opcode) {
     switch (opcode) {
@@ -117,7 +290,7 @@ void CPU::execute(u8 opcode) {
             PC++;  // Stop instruction will skip the immediate next byte
             break;
         case 0x76:  // HALT
-            halted = ime || !(memory->read(IOReg::IF_REG) & memory->read(IOReg::IE_REG) & 0x1F);
+            halted = ime || !memory->get_pending_interrupts();
             if (!halted) haltBug = true;
             break;
         case 0xF3: ime = false; break;         // DI
@@ -234,6 +407,7 @@ void CPU::execute(u8 opcode) {
         case 0xD1: pop(regs.DE); break;  // POP DE
         case 0xE1: pop(regs.HL); break;  // POP HL
         case 0xF1:
+            materialize_flags();
             regs.F = (read(SP++) & 0xF0) | (regs.F & 0xF);
             regs.A = read(SP++);
             break; // POP AF
@@ -241,7 +415,7 @@ void CPU::execute(u8 opcode) {
         case 0xC5: push(regs.BC); break; // PUSH BC
         case 0xD5: push(regs.DE); break; // PUSH DE
         case 0xE5: push(regs.HL); break; // PUSH HL
-        case 0xF5: push(regs.AF); break; // PUSH AF
+        case 0xF5: materialize_flags(); push(regs.AF); break; // PUSH AF
         // load SP
         case 0x08: {
             u16 addr = nn();
@@ -460,35 +634,30 @@ void CPU::execute(u8 opcode) {
         // JR
         case 0x18: {
             s8 off = (s8)n();
-            PC += off;
-            memory->sleep_cycle();
+            jump_relative(off);
         } break; // JR n
         case 0x20: {
             s8 off = (s8)n();
             if (!check_flag(Flag::Z)) {
-                PC += off;
-                memory->sleep_cycle();
+                jump_relative(off);
             }
         } break; // JR NZ, n
         case 0x30: {
             s8 off = (s8)n();
             if (!check_flag(Flag::C)) {
-                PC += off;
-                memory->sleep_cycle();
+                jump_relative(off);
             }
         } break; // JR NC, n
         case 0x28: {
             s8 off = (s8)n();
             if (check_flag(Flag::Z)) {
-                PC += off;
-                memory->sleep_cycle();
+                jump_relative(off);
             }
         } break; // JR Z, n
         case 0x38: {
             s8 off = (s8)n();
             if (check_flag(Flag::C)) {
-                PC += off;
-                memory->sleep_cycle();
+                jump_relative(off);
             }
         } break; // JR C, n
         // CALL
@@ -744,17 +913,89 @@ void CPU::execute_cb() {
 }
 // clang-format on
 
-void CPU::set_flag(Flag flag, bool set) { regs.F = (regs.F & ~((u8)flag) | (((u8)flag) * set)); }
+void CPU::set_flag(Flag flag, bool set) {
+    materialize_flags();
+    regs.F = (regs.F & ~((u8)flag) | (((u8)flag) * set));
+}
 
-bool CPU::check_flag(Flag flag) { return (regs.F & ((u8)flag)) != 0; }
+bool CPU::check_flag(Flag flag) {
+    if (flagOp != FlagOp::NONE) {
+        if (flag == Flag::Z) {
+            return flagRes == 0;
+        }
+        if (flag == Flag::C) {
+            return deferred_carry();  // INC and DEC keep the carry without materializing the flags
+        }
+        materialize_flags();
+    }
+    return (regs.F & ((u8)flag)) != 0;
+}
 
-u8 CPU::n() { return read(PC++); }
+void CPU::defer_flags(FlagOp op, u8 a, u8 b, u8 carry, u8 res) {
+    flagOp = op;
+    flagA = a;
+    flagB = b;
+    flagCarry = carry;
+    flagRes = res;
+}
+
+// Carry flag of the deferred op, or of regs.F if it is up to date
+bool CPU::deferred_carry() {
+    switch (flagOp) {
+        case FlagOp::ADD:
+            return flagCarry + flagA + flagB > 0xFF;
+        case FlagOp::SUB:
+            return flagA < flagB + flagCarry;
+        case FlagOp::INC:
+        case FlagOp::DEC:
+            return flagCarry;
+        default:
+            return (regs.F & (u8)Flag::C) != 0;
+    }
+}
+
+void CPU::materialize_flags() {
+    bool n = false;
+    bool h = false;
+    bool c = false;
+    switch (flagOp) {
+        case FlagOp::NONE:
+            return;
+        case FlagOp::ADD:
+            h = flagCarry + (flagA & 0xF) + (flagB & 0xF) > 0xF;
+            c = flagCarry + flagA + flagB > 0xFF;
+            break;
+        case FlagOp::SUB:
+            n = true;
+            h = (flagA & 0xF) < ((flagB & 0xF) + flagCarry);
+            c = flagA < flagB + flagCarry;
+            break;
+        case FlagOp::INC:
+            h = !(flagRes & 0xF);
+            c = flagCarry;
+            break;
+        case FlagOp::DEC:
+            n = true;
+            h = (flagRes & 0xF) == 0xF;
+            c = flagCarry;
+            break;
+    }
+    regs.F = (u8)((flagRes == 0) << 7 | n << 6 | h << 5 | c << 4);
+    flagOp = FlagOp::NONE;
+}
+
+u8 CPU::n() {
+    if (immediates) {
+        memory->sleep_cycle();
+        PC++;
+        return *immediates++;
+    }
+    return read(PC++);
+}
 
 u16 CPU::nn() {
-    u16 res = read(PC);
-    PC++;
-    res |= read(PC) << 8;
-    PC++;
+    u16 res = n();
+    res |= n() << 8;
     return res;
 }
 
@@ -781,85 +1022,63 @@ void CPU::push(u16 reg) {
 
 void CPU::add8(u8 val) {
     u8 res = regs.A + val;
-    set_flag(Flag::Z, res == 0);
-    set_flag(Flag::N, false);
-    set_flag(Flag::H, (regs.A & 0xF) + (val & 0xF) > 0xF);
-    set_flag(Flag::C, (0xFF - regs.A) < val);
+    defer_flags(FlagOp::ADD, regs.A, val, 0, res);
     regs.A = res;
 }
 
 void CPU::adc8(u8 val) {
     u8 carry = check_flag(Flag::C);
     u8 res = regs.A + val + carry;
-    set_flag(Flag::Z, res == 0);
-    set_flag(Flag::N, false);
-    set_flag(Flag::H, carry + (regs.A & 0xF) + (val & 0xF) > 0xF);
-    set_flag(Flag::C, val + carry > 0xFF - regs.A);
+    defer_flags(FlagOp::ADD, regs.A, val, carry, res);
     regs.A = res;
 }
 
 void CPU::sub8(u8 val) {
     u8 res = regs.A - val;
-    set_flag(Flag::Z, regs.A == val);
-    set_flag(Flag::N, true);
-    set_flag(Flag::H, (regs.A & 0xF) < (val & 0xF));
-    set_flag(Flag::C, regs.A < val);
+    defer_flags(FlagOp::SUB, regs.A, val, 0, res);
     regs.A = res;
 }
 
 void CPU::sbc8(u8 val) {
     u8 carry = check_flag(Flag::C);
     u8 res = regs.A - (val + carry);
-    set_flag(Flag::Z, res == 0);
-    set_flag(Flag::N, true);
-    set_flag(Flag::H, (regs.A & 0xF) < ((val & 0xF) + carry));
-    set_flag(Flag::C, regs.A < val + carry);
+    defer_flags(FlagOp::SUB, regs.A, val, carry, res);
     regs.A = res;
 }
 
 void CPU::and8(u8 val) {
     regs.A &= val;
-    set_flag(Flag::Z, regs.A == 0);
-    set_flag(Flag::N, false);
-    set_flag(Flag::H, true);
-    set_flag(Flag::C, false);
+    flagOp = FlagOp::NONE;
+    regs.F = (u8)((regs.A == 0) << 7 | (u8)Flag::H);
 }
 
 void CPU::xor8(u8 val) {
     regs.A ^= val;
-    set_flag(Flag::Z, regs.A == 0);
-    set_flag(Flag::N, false);
-    set_flag(Flag::H, false);
-    set_flag(Flag::C, false);
+    flagOp = FlagOp::NONE;
+    regs.F = (u8)((regs.A == 0) << 7);
 }
 
 void CPU::or8(u8 val) {
     regs.A |= val;
-    set_flag(Flag::Z, regs.A == 0);
-    set_flag(Flag::N, false);
-    set_flag(Flag::H, false);
-    set_flag(Flag::C, false);
+    flagOp = FlagOp::NONE;
+    regs.F = (u8)((regs.A == 0) << 7);
 }
 
 void CPU::cp8(u8 val) {
-    set_flag(Flag::Z, regs.A == val);
-    set_flag(Flag::N, true);
-    set_flag(Flag::H, (regs.A & 0xF) < (val & 0xF));
-    set_flag(Flag::C, regs.A < val);
+    u8 res = regs.A - val;
+    defer_flags(FlagOp::SUB, regs.A, val, 0, res);
 }
 
 void CPU::inc8(u8& reg) {
+    u8 carry = check_flag(Flag::C);
     reg++;
-    set_flag(Flag::Z, reg == 0);
-    set_flag(Flag::N, false);
-    set_flag(Flag::H, !(reg & 0xF));
+    defer_flags(FlagOp::INC, 0, 0, carry, reg);
 }
 
 void CPU::dec8(u8& reg) {
+    u8 carry = check_flag(Flag::C);
     reg--;
-    set_flag(Flag::Z, reg == 0);
-    set_flag(Flag::N, true);
-    set_flag(Flag::H, (reg & 0xF) == 0xF);
+    defer_flags(FlagOp::DEC, 0, 0, carry, reg);
 }
 
 void CPU::add16(u16 val) {
@@ -902,17 +1121,23 @@ void CPU::daa() {
 }
 
 void CPU::jump_nn() {
-    u8 loByte = read(PC);
-    u8 hiByte = read(PC + 1);
-    PC = loByte | (hiByte << 8);
+    PC = nn();
+    memory->sleep_cycle();
+}
+
+void CPU::jump_relative(s8 off) {
+    u16 jumpAddr = PC - 2;
+    PC += off;
     memory->sleep_cycle();
+    if (off < 0) {
+        check_poll_loop(jumpAddr);
+    }
 }
 
 void CPU::call_nn() {
-    u8 loByte = read(PC);
-    u8 hiByte = read(PC + 1);
-    push(PC + 2);
-    PC = loByte | (hiByte << 8);
+    u16 addr = nn();
+    push(PC);
+    PC = addr;
 }
 
 void CPU::rst(u16 addr) {
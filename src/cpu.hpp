@@ -1,16 +1,25 @@
 #pragma once
 
+#include "block_cache.hpp"
 #include "debugger.hpp"
 #include "general.hpp"
 #include "memory.hpp"
+#include "recompiler.hpp"
 
 class Memory;
 class Debugger;
 
+enum class CPUBackend : u8 {
+    INTERPRETER,         // decode every instruction from memory
+    CACHED_INTERPRETER,  // reuse decoded blocks of instructions
+    RECOMPILER,          // translate blocks to native x86-64 code
+};
+
 class CPU {
 public:
     CPU(Memory& memory);
     void set_debugger(Debugger& debug) { this->debugger = &debug; }
+    void set_backend(CPUBackend backend);
     void restart();
 
     void handle_interrupts();
@@ -18,10 +27,16 @@ public:
 
 private:
     friend class Debugger;
+    friend class Recompiler;
     Debugger* debugger;
 
     Memory* memory;
 
+    CPUBackend backend = CPUBackend::CACHED_INTERPRETER;
+    BlockCache blockCache;
+    Recompiler recompiler;
+    const u8* immediates;  // immediate bytes of the current instruction if it was decoded
+
     // clang-format off
     union {
         struct {
@@ -48,6 +63,20 @@ private:
     bool ime;
     bool imeScheduled;
 
+    void execute_fetched();
+    void skip_stalled_cycles();
+
+    // State at the end of the last backward jump, to skip loops polling for an event
+    struct {
+        u16 pc;
+        u8 A;
+        u8 F;
+        u64 cycle;
+        u32 eventCycles;
+    } lastLoop;
+    void check_poll_loop(u16 jumpAddr);
+    u32 get_poll_loop_cycles(u16 start, u16 jumpAddr);
+
     void execute(u8 opcode);
     void execute_cb();
 
@@ -60,6 +89,23 @@ private:
     void set_flag(Flag flag, bool set);
     bool check_flag(Flag flag);
 
+    // Flags of the last 8-bit arithmetic op are computed from its operands only when read
+    enum class FlagOp : u8 {
+        NONE,  // regs.F is up to date
+        ADD,   // ADD, ADC
+        SUB,   // SUB, SBC, CP
+        INC,
+        DEC,
+    };
+    FlagOp flagOp;
+    u8 flagA;
+    u8 flagB;
+    u8 flagCarry;  // carry into ADC/SBC, carry left unchanged by INC/DEC
+    u8 flagRes;
+    void defer_flags(FlagOp op, u8 a, u8 b, u8 carry, u8 res);
+    bool deferred_carry();
+    void materialize_flags();
+
     u8 n();
     u16 nn();
     u8 read(u16 addr);
@@ -87,6 +133,7 @@ private:
     void daa();
 
     void jump_nn();
+    void jump_relative(s8 off);
     void call_nn();
     void rst(u16 addr);
 
@@ -294,7 +294,7 @@ std::string Debugger::disassemble(u16 pc) {
 }
 
 static constexpr u8 PPU_STATE_MAP[] = {
-    2, 2, 2, 2, 3, 3, 3, 0, 0, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 3, 3, 3, 3, 0, 0, 1, 1, 1, 1, 1, 1,
 };
 static constexpr struct {
     const char* name;
@@ -310,6 +310,7 @@ void Debugger::print_info() {
     printf("---------------\n");
     printf(" %04x => %s => %02x\n", cpu->PC, disassemble(cpu->PC).c_str(), memory->read(cpu->PC));
 
+    cpu->materialize_flags();
     printf("\tZNHC=%d%d%d%d\n", cpu->check_flag(CPU::Flag::Z), cpu->check_flag(CPU::Flag::N),
            cpu->check_flag(CPU::Flag::H), cpu->check_flag(CPU::Flag::C));
     printf("\tAF=%04x BC=%04x DE=%04x HL=%04x SP=%04x\n", cpu->regs.AF, cpu->regs.BC, cpu->regs.DE,
@@ -0,0 +1,98 @@
+#include "frame_worker.hpp"
+
+#include <cstring>
+
+FrameWorker::~FrameWorker() { set_threaded(false); }
+
+void FrameWorker::restart() {
+    wait();
+    allLinesChanged = true;
+}
+
+void FrameWorker::invalidate() {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [this] { return !hasJob; });
+    allLinesChanged = true;
+}
+
+void FrameWorker::set_threaded(bool threaded) {
+    if (threaded == is_threaded()) {
+        return;
+    }
+    if (threaded) {
+        stop = false;
+        thread = std::thread(&FrameWorker::run, this);
+    } else {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        jobReady.notify_one();
+        thread.join();
+    }
+}
+
+void FrameWorker::process(const void* frame, u32 lineSize) {
+    const u8* data = static_cast<const u8*>(frame);
+    for (int i = 0; i < 5; i++) {
+        info.changedLines[i] = 0;
+    }
+    if (lineSize != prevLineSize) {
+        prevFrame.reset(new u8[lineSize * Constants::HEIGHT]);
+        prevLineSize = lineSize;
+        allLinesChanged = true;
+    }
+    u8* prevLine = prevFrame.get();
+    for (int line = 0; line < Constants::HEIGHT; line++) {
+        u32 hash = 0x811C9DC5;
+        for (u32 i = 0; i < lineSize; i += 4) {
+            u32 word;
+            memcpy(&word, data + i, 4);
+            hash = (hash ^ word) * 0x9E3779B1;
+            hash ^= hash >> 15;
+        }
+
+        // Equal hashes are checked against the copy of the line, so collisions aren't missed
+        info.lineHashes[line] = hash;
+        if (allLinesChanged || hash != prevLineHashes[line] ||
+            memcmp(data, prevLine, lineSize) != 0) {
+            info.changedLines[line >> 5] |= 1u << (line & 31);
+            memcpy(prevLine, data, lineSize);
+        }
+        prevLineHashes[line] = hash;
+        data += lineSize;
+        prevLine += lineSize;
+    }
+    allLinesChanged = false;
+}
+
+void FrameWorker::submit(const void* frame, u32 lineSize) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobFrame = frame;
+        jobLineSize = lineSize;
+        hasJob = true;
+    }
+    jobReady.notify_one();
+}
+
+void FrameWorker::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [this] { return !hasJob; });
+}
+
+void FrameWorker::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        jobReady.wait(lock, [this] { return hasJob || stop; });
+        if (stop) {
+            return;
+        }
+        lock.unlock();
+        process(jobFrame, jobLineSize);
+        lock.lock();
+        hasJob = false;
+        jobDone.notify_all();
+    }
+}
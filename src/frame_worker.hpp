@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "general.hpp"
+
+struct FrameInfo {
+    // Bit (line & 31) of word (line >> 5) is set if the line differs from the last passed frame
+    u32 changedLines[5];
+    u32 lineHashes[144];
+};
+
+// Hashes the lines of finished frames and compares them against the previous frame. When threaded
+// a frame is processed on a worker thread while the next one is emulated.
+class FrameWorker {
+public:
+    ~FrameWorker();
+    void restart();
+    void set_threaded(bool threaded);
+    bool is_threaded() { return thread.joinable(); }
+
+    // Marks every line of the next frame as changed, waits for a running job which reads the flag
+    void invalidate();
+
+    void process(const void* frame, u32 lineSize);
+    void submit(const void* frame, u32 lineSize);
+    void wait();
+    const FrameInfo& get_info() { return info; }
+
+private:
+    void run();
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    bool hasJob = false;
+    bool stop = false;
+    const void* jobFrame;
+    u32 jobLineSize;
+
+    FrameInfo info;
+    u32 prevLineHashes[144];
+    std::unique_ptr<u8[]> prevFrame;  // copy of the last passed frame
+    u32 prevLineSize = 0;
+    bool allLinesChanged;
+};
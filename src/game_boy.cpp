@@ -99,6 +99,7 @@ void GameBoy::load(const char* romPath) {
     serial.restart();
     ppu.restart();
     apu.restart();
+    memory.schedule_events();
 }
 
 void GameBoy::set_debugger(Debugger& debugger) {
@@ -124,11 +125,13 @@ void GameBoy::emulate_frame() {
     if (frameElapsed) {
         memory.reset_elapsed_cycles();
     }
+    apu.end_frame();
 }
 
-void GameBoy::emulate_frame(u32* screenBuffer, s16* sampleBuffer, u16 sampleLen) {
+void GameBoy::emulate_frame(PixelFormat format, bool render, s16* sampleBuffer, u16 sampleLen) {
+    ppu.set_pixel_format(format);
+    ppu.set_rendering(render);
     emulate_frame();
-    ppu.render(screenBuffer);
     if (debugger->is_paused()) {
         for (int i = 0; i < sampleLen; i++) {
             sampleBuffer[i] = 0;
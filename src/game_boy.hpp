@@ -18,12 +18,25 @@ public:
     void load(const char* romPath);
 
     void set_debugger(Debugger& debugger);
+    void set_cpu_backend(CPUBackend backend) { cpu.set_backend(backend); }
     void handle_key_code(bool pressed, JoypadButton button) {
         input.handle_input(pressed, (u8)button);
     }
 
+    // Must be set before loading a rom, frames are passed to onFrame as they complete. Without
+    // buffers frames are emulated but not drawn.
+    void set_frame_buffers(void* const* buffers, u8 numBuffers, FrameCallback onFrame,
+                           void* userData) {
+        ppu.set_frame_buffers(buffers, numBuffers, onFrame, userData);
+    }
+
+    // See PPU::set_threaded
+    void set_threaded_frames(bool threaded) { ppu.set_threaded(threaded); }
+
     void emulate_frame();
-    void emulate_frame(u32* screenBuffer, s16* sampleBuffer, u16 sampleLen);
+    // render applies to frames started during this call. These complete within the same call
+    // unless the LCD was switched back on mid-call, see PPU::set_rendering
+    void emulate_frame(PixelFormat format, bool render, s16* sampleBuffer, u16 sampleLen);
 
 private:
     Debugger* debugger;
@@ -5,9 +5,12 @@
 using u8 = uint8_t;
 using u16 = uint16_t;
 using u32 = uint32_t;
+using u64 = uint64_t;
 
 using s8 = int8_t;
 using s16 = int16_t;
+using s32 = int32_t;
+using s64 = int64_t;
 
 #ifndef DEBUG
 #define DEBUG true
@@ -22,28 +25,6 @@ using s16 = int16_t;
     snprintf(buff + 13 * sizeof(char), sizeof(buff) - 13 * sizeof(char), __VA_ARGS__); \
     throw std::runtime_error(buff)
 
-template <typename T, int capacity>
-struct Queue {
-    void clear() {
-        offset = 0;
-        size = 0;
-    }
-    T* get(u8 index) { return &data[(index + offset) % capacity]; }
-    void set(u8 index, T&& val) { data[(index + offset) % capacity] = val; }
-    void push_tail(T&& val) { data[(offset + size++) % capacity] = val; }
-    T pop_head() {
-        T val = data[offset];
-        offset = (offset + 1) % capacity;
-        size--;
-        return val;
-    }
-    T head() { return data[offset]; }
-
-    u8 offset = 0;
-    u8 size = 0;
-    T data[capacity];
-};
-
 namespace Constants {
 
 constexpr const char* TITLE = "GameBoy Emulator";
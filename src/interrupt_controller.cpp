@@ -0,0 +1,12 @@
+#include "interrupt_controller.hpp"
+
+void InterruptController::set_registers(u8& ifReg, u8& ieReg) {
+    this->ifReg = &ifReg;
+    this->ieReg = &ieReg;
+    update();
+}
+
+void InterruptController::request(Interrupt interrupt) {
+    *ifReg |= (u8)interrupt;
+    update();
+}
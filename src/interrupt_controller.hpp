@@ -0,0 +1,21 @@
+#pragma once
+
+#include "general.hpp"
+
+// Keeps the mask of requested and enabled interrupts up to date, so the CPU can check for
+// pending interrupts without reading IF and IE through the memory map
+class InterruptController {
+public:
+    void set_registers(u8& ifReg, u8& ieReg);
+
+    void request(Interrupt interrupt);
+    void update() { pending = *ifReg & *ieReg & 0x1F; }  // Called after IF or IE is written
+
+    u8 get_flags() { return *ifReg; }
+    u8 get_pending() { return pending; }
+
+private:
+    u8* ifReg;
+    u8* ieReg;
+    u8 pending;  // IF & IE
+};
@@ -12,11 +12,16 @@ struct Screen {
     SDL_Window* window;
     SDL_Renderer* renderer;
 
-    int pitch = 0;
-    u32* pixelBuffer;
     SDL_Texture* bufferTexture;
+
+    u32 frames[2][Constants::WIDTH * Constants::HEIGHT];
+    u32* shownFrame;
 };
 
+void on_frame(void* userData, void* frame, const FrameInfo&) {
+    static_cast<Screen*>(userData)->shownFrame = static_cast<u32*>(frame);
+}
+
 void create_screen(Screen& screen, int width, int height, const char* title) {
     screen.window = SDL_CreateWindow(title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width,
                                      height, SDL_WINDOW_SHOWN);
@@ -33,7 +38,7 @@ void create_screen(Screen& screen, int width, int height, const char* title) {
                   << std::endl;
     }
 
-    screen.pitch = 0;
+    screen.shownFrame = screen.frames[1];
 }
 
 void destroy_screen(Screen& screen) {
@@ -160,19 +165,16 @@ void run(Screen& screen, GameBoy& gameboy, Debugger& debugger) {
 
         SDL_RenderClear(screen.renderer);
 
-        if (SDL_LockTexture(screen.bufferTexture, nullptr, (void**)&screen.pixelBuffer,
-                            &screen.pitch)) {
-            fatal("Failed to lock texture! SDL_error: %s\n", SDL_GetError());
-        }
-        screen.pitch /= sizeof(u32);
-
         frameAcc += FLOATING_OFF;
         u32 sampleLen = ((int)SAMPLES_PER_FRAME + (frameAcc >= 1)) * 2;
-        gameboy.emulate_frame(screen.pixelBuffer, sampleBuffer, sampleLen);
+        gameboy.emulate_frame(PixelFormat::ARGB8888, true, sampleBuffer, sampleLen);
         SDL_QueueAudio(1, sampleBuffer, sampleLen * sizeof(u16));
         frameAcc -= frameAcc >= 1;
 
-        SDL_UnlockTexture(screen.bufferTexture);
+        if (SDL_UpdateTexture(screen.bufferTexture, nullptr, screen.shownFrame,
+                              (int)(Constants::WIDTH * sizeof(u32)))) {
+            fatal("Failed to update texture! SDL_error: %s\n", SDL_GetError());
+        }
 
         SDL_RenderCopy(screen.renderer, screen.bufferTexture, nullptr, nullptr);
         SDL_RenderPresent(screen.renderer);
@@ -227,6 +229,8 @@ int main(int argc, char** argv) {
     Screen screen;
     create_screen(screen, Constants::WIDTH * Screen::PIXEL_SCALE,
                   Constants::HEIGHT * Screen::PIXEL_SCALE, Constants::TITLE);
+    void* frames[] = {screen.frames[0], screen.frames[1]};
+    gameboy.set_frame_buffers(frames, 2, on_frame, &screen);
 
     try {
         gameboy.load(argv[1]);
@@ -28,6 +28,17 @@ constexpr u8 CGB_BOOT_IO[] = {
 void Memory::restart() {
     curWramBank = &wramBanks[1];
 
+    for (int i = 0; i < NUM_PAGES; i++) {
+        readPages[i] = nullptr;
+        writePages[i] = nullptr;
+    }
+    for (u32& count : writeCounts) {
+        count = 0;
+    }
+    map_cartridge();
+    map_wram();
+    map_io_registers();
+
     if (is_CGB_mode()) {
         for (int i = 0xFF00; i < 0xFF78; i++) {
             mem[i] = CGB_BOOT_IO[i - 0xFF00];
@@ -57,10 +68,15 @@ void Memory::restart() {
         }
     }
     mem[IOReg::IE_REG] = 0x00;
+    interrupts.set_registers(mem[IOReg::IF_REG], mem[IOReg::IE_REG]);
+
+    scheduler.restart();
+    clocksPerCycle = 4;
+    numEventCycles = 0;
 
     isDoubleSpeed = false;
     prepareSpeedSwitch = false;
-    speedSwitchCycleCnt = 0;
+    isSpeedSwitching = false;
 
     dmaInProgress = false;
     scheduleDma = false;
@@ -76,11 +92,42 @@ void Memory::restart() {
     elapsedCycles = 0;
 }
 
-void Memory::request_interrupt(Interrupt interrupt) { mem[IOReg::IF_REG] |= (u8)interrupt; }
-
 u8& Memory::ref(u16 addr) { return mem[addr]; }
 
+void Memory::map_cartridge() {
+    u8* zeroBank = cartridge->get_zero_bank();
+    u8* highBank = cartridge->get_high_bank();
+    for (int i = 0; i < 4; i++) {
+        readPages[0x0 + i] = zeroBank + i * PAGE_SIZE;
+        readPages[0x4 + i] = highBank + i * PAGE_SIZE;
+    }
+
+    u8* ramBank = cartridge->get_ram_bank();
+    for (int i = 0; i < 2; i++) {
+        readPages[0xA + i] = ramBank ? ramBank + i * PAGE_SIZE : nullptr;
+        writePages[0xA + i] = readPages[0xA + i];
+    }
+}
+
+void Memory::map_wram() {
+    readPages[0xC] = writePages[0xC] = wramBanks[0];
+    readPages[0xD] = writePages[0xD] = *curWramBank;
+    // Echo ram writes are redirected so they are counted at their WRAM address
+    readPages[0xE] = wramBanks[0];  // 0xF000-0xFDFF echo is mixed with OAM/IO
+}
+
+void Memory::map_vram(u8* readBank, u8* writeBank) {
+    for (int i = 0; i < 2; i++) {
+        readPages[0x8 + i] = readBank ? readBank + i * PAGE_SIZE : nullptr;
+        writePages[0x8 + i] = writeBank ? writeBank + i * PAGE_SIZE : nullptr;
+    }
+}
+
 u8 Memory::read(u16 addr) {
+    u8* page = readPages[addr >> 12];
+    if (page) {
+        return page[addr & (PAGE_SIZE - 1)];
+    }
     if (addr < 0x8000) {
         return cartridge->read_rom(addr);
     }
@@ -108,26 +155,28 @@ u8 Memory::read(u16 addr) {
         }
         return mem[addr];
     }
-    if (0xFF10 <= addr && addr <= 0xFF26) {
-        return apu->read_register(mem[addr], addr & 0xFF);
-    }
-    if (is_CGB_mode()) {
-        if (addr == 0xFF76) {
-            return apu->read_pcm12();
-        }
-        if (addr == 0xFF77) {
-            return apu->read_pcm34();
+    if (addr < 0xFF80) {
+        IORegister& reg = ioRegs[addr - 0xFF00];
+        if (reg.read) {
+            return (this->*reg.read)(addr);
         }
-    }
-    if (addr == IOReg::JOYP_REG) {
-        return input->get_key_state(mem[addr]);
+        return mem[addr] | reg.readMask;
     }
     return mem[addr];
 }
 
 void Memory::write(u16 addr, u8 val) {
+    u8* page = writePages[addr >> 12];
+    if (page) {
+        page[addr & (PAGE_SIZE - 1)] = val;
+        writeCounts[addr >> 8]++;
+        return;
+    }
     if (addr < 0x8000 || (0xA000 <= addr && addr < 0xC000)) {
+        sync_cartridge();
         cartridge->write(addr, val);
+        schedule_cartridge();
+        map_cartridge();
         return;
     }
     if (0x8000 <= addr && addr < 0xA000) {
@@ -157,221 +206,320 @@ void Memory::write(u16 addr, u8 val) {
         if (ppu->is_oam_write_blocked()) {
             return;
         }
-    }
-    if (0xFF03 == addr) {
+        if (addr < 0xFEA0) {
+            ppu->write_oam(addr, val);
+        } else {
+            mem[addr] = val;
+        }
         return;
     }
-    if (0xFF08 <= addr && addr <= 0xFF0E) {
+    if (addr < 0xFF80) {
+        IORegister& reg = ioRegs[addr - 0xFF00];
+        mem[addr] = (mem[addr] & ~reg.writeMask) | (val & reg.writeMask) | reg.readMask;
+        if (reg.write) {
+            (this->*reg.write)(addr, val);
+        }
         return;
     }
-    if (0xFF10 <= addr && addr <= 0xFF26) {
-        apu->write_register(addr & 0xFF, val);
-        mem[addr] = val;
-        return;
+    mem[addr] = val;
+    if (addr == IOReg::IE_REG) {
+        interrupts.update();
     }
-    if (0xFF27 <= addr && addr <= 0xFF30) {
-        return;
+}
+
+void Memory::map_io_registers() {
+    // Default to a plain read/write register
+    for (IORegister& reg : ioRegs) {
+        reg = {nullptr, nullptr, 0xFF, 0x00};
+    }
+    // Unused registers always read back as 0xFF
+    auto set_unused = [this](u16 first, u16 last) {
+        for (u16 addr = first; addr <= last; addr++) {
+            ioRegs[addr - 0xFF00] = {nullptr, nullptr, 0x00, 0xFF};
+        }
+    };
+    auto set = [this](u16 addr, u8 writeMask, u8 readMask, IOWriteHandler write,
+                      IOReadHandler read = nullptr) {
+        ioRegs[addr - 0xFF00] = {read, write, writeMask, readMask};
+    };
+
+    set(IOReg::JOYP_REG, 0x30, 0xC0, nullptr, &Memory::read_joyp);
+    set(IOReg::SC_REG, 0x00, 0x00, &Memory::write_sc);
+    set_unused(0xFF03, 0xFF03);
+    set(IOReg::DIV_REG, 0x00, 0x00, &Memory::write_div, &Memory::read_div);
+    set(IOReg::TIMA_REG, 0x00, 0x00, &Memory::write_tima);
+    set(IOReg::TMA_REG, 0x00, 0x00, &Memory::write_tma);
+    set(IOReg::TAC_REG, 0x07, 0xF8, &Memory::write_tac);
+    set_unused(0xFF08, 0xFF0E);
+    set(IOReg::IF_REG, 0x1F, 0xE0, &Memory::write_if);
+    for (u16 addr = IOReg::NR10_REG; addr <= IOReg::NR52_REG; addr++) {
+        set(addr, 0x00, 0x00, &Memory::write_apu, &Memory::read_apu);
+    }
+    set_unused(0xFF27, 0xFF2F);
+    set(IOReg::WAVE_TABLE_START_REG, 0x00, 0x00, nullptr);
+    for (u16 addr = IOReg::WAVE_TABLE_START_REG + 1; addr <= 0xFF3F; addr++) {
+        set(addr, 0x00, 0x00, &Memory::write_wave);
+    }
+    set(IOReg::LCDC_REG, 0x00, 0x00, &Memory::write_lcd);
+    set(IOReg::STAT_REG, 0x00, 0x00, &Memory::write_lcd);
+    set(IOReg::SCY_REG, 0x00, 0x00, &Memory::write_lcd);
+    set(IOReg::SCX_REG, 0x00, 0x00, &Memory::write_lcd);
+    set(IOReg::LYC_REG, 0x00, 0x00, &Memory::write_lcd);
+    set(IOReg::DMA_REG, 0x00, 0x00, &Memory::write_dma);
+    for (u16 addr = IOReg::BGP_REG; addr <= IOReg::WX_REG; addr++) {
+        set(addr, 0x00, 0x00, &Memory::write_lcd);
     }
-    if (0xFF57 <= addr && addr <= 0xFF67) {
+    if (!is_CGB()) {
+        set_unused(0xFF4C, 0xFF7F);
         return;
     }
-    if (0xFF6D <= addr && addr <= 0xFF6F) {
+
+    set_unused(0xFF4C, 0xFF4C);
+    set(IOReg::KEY1_REG, 0x00, 0x00, &Memory::write_key1);
+    set_unused(0xFF4E, 0xFF4E);
+    set(IOReg::VBK_REG, 0x00, 0x00, nullptr);
+    set_unused(0xFF50, 0xFF50);
+    set(IOReg::HDMA1_REG, 0x00, 0x00, &Memory::write_hdma1);
+    set(IOReg::HDMA2_REG, 0x00, 0x00, &Memory::write_hdma2);
+    set(IOReg::HDMA3_REG, 0x00, 0x00, &Memory::write_hdma3);
+    set(IOReg::HDMA4_REG, 0x00, 0x00, &Memory::write_hdma4);
+    set(IOReg::HDMA5_REG, 0x00, 0x00, nullptr);
+    set(IOReg::RP_REG, 0x00, 0x00, nullptr);
+    set_unused(0xFF57, 0xFF67);
+    for (u16 addr = IOReg::BGPI_REG; addr <= IOReg::OBPD_REG; addr++) {
+        set(addr, 0x00, 0x00, &Memory::write_palette);
+    }
+    set(IOReg::OPRI_REG, 0x00, 0x00, nullptr);
+    set_unused(0xFF6D, 0xFF6F);
+    set(IOReg::SVBK_REG, 0x00, 0x00, nullptr);
+    set_unused(0xFF71, 0xFF71);
+    set_unused(0xFF74, 0xFF74);
+    set(0xFF75, 0x70, 0x8F, nullptr);
+    set(IOReg::PCM12_REG, 0x00, 0x00, nullptr);
+    set(IOReg::PCM34_REG, 0x00, 0x00, nullptr);
+    set_unused(0xFF78, 0xFF7F);
+    if (!is_CGB_mode()) {
         return;
     }
-    if (0xFF78 <= addr && addr <= 0xFF7F) {
+
+    set(IOReg::VBK_REG, 0x01, 0xFE, &Memory::write_vbk);
+    set(IOReg::HDMA5_REG, 0x00, 0x00, &Memory::write_hdma5);
+    set(IOReg::RP_REG, 0xC1, 0x3E, &Memory::write_rp);
+    set(IOReg::SVBK_REG, 0x07, 0xF8, &Memory::write_svbk);
+    set(IOReg::PCM12_REG, 0x00, 0x00, nullptr, &Memory::read_pcm12);
+    set(IOReg::PCM34_REG, 0x00, 0x00, nullptr, &Memory::read_pcm34);
+}
+
+u8 Memory::read_joyp(u16 addr) { return input->get_key_state(mem[addr]); }
+
+u8 Memory::read_div(u16 addr) {
+    sync_timer();
+    return mem[addr];
+}
+
+u8 Memory::read_apu(u16 addr) {
+    sync_apu();
+    return apu->read_register(mem[addr], addr & 0xFF);
+}
+
+u8 Memory::read_pcm12(u16) {
+    sync_apu();
+    return apu->read_pcm12();
+}
+
+u8 Memory::read_pcm34(u16) {
+    sync_apu();
+    return apu->read_pcm34();
+}
+
+void Memory::write_if(u16, u8) { interrupts.update(); }
+
+void Memory::write_sc(u16 addr, u8 val) {
+    mem[addr] = (val & (1 << 8)) | 0x7E | (val & 1);
+    if (is_CGB_mode() && (val & (1 << 1))) {
+        fatal("TODO serial clock speed unimplemented for CGB");
+    }
+    if ((val & 0x81) == 0x81) {
+        sync_serial();
+        serial->trigger_transfer();
+        schedule_serial();
+    }
+}
+
+void Memory::write_div(u16, u8) {
+    sync_timer();
+    timer->reset_div();
+    schedule_timer();
+}
+
+void Memory::write_tima(u16, u8 val) {
+    sync_timer();
+    timer->write_tima(val);
+    schedule_timer();
+}
+
+void Memory::write_tma(u16, u8 val) {
+    sync_timer();
+    timer->write_tma(val);
+    schedule_timer();
+}
+
+void Memory::write_tac(u16, u8 val) {
+    sync_timer();
+    timer->write_tac(val);
+    schedule_timer();
+}
+
+void Memory::write_apu(u16 addr, u8 val) {
+    sync_apu();
+    apu->write_register(addr & 0xFF, val);
+    mem[addr] = val;
+}
+
+// The wave channel reads samples straight from wave RAM, so it has to catch up first
+void Memory::write_wave(u16 addr, u8 val) {
+    sync_apu();
+    mem[addr] = val;
+}
+
+void Memory::write_lcd(u16 addr, u8 val) {
+    sync_ppu();
+    ppu->write_register(addr, val);
+    schedule_ppu();
+}
+
+void Memory::write_dma(u16 addr, u8 val) {
+    // TODO verify this. According to docs, val >= 0xE0 is undefined behavior
+    if (val >= 0xE0) {
+        val &= ~0x20;
+    }
+    scheduleDma = true;  // DMA idles for 1 cycle before starting
+    scheduler.schedule(Event::DMA, 0);
+    dmaStartAddr = val << 8;
+    mem[addr] = val;
+}
+
+void Memory::write_key1(u16 addr, u8 val) {
+    if (val & 0x1) {
+        prepareSpeedSwitch = true;
+    }
+    if (cartridge->is_CGB_mode()) {
+        mem[addr] = (isDoubleSpeed << 7) | 0x7E | (val & 0x1);
+    }
+}
+
+void Memory::write_vbk(u16, u8 val) { ppu->write_vbk(val); }
+
+void Memory::write_hdma1(u16, u8 val) {
+    if (hdmaBytesLeft == 0) {
+        hdmaSource = (val << 8) | (hdmaSource & 0xFF);
+    } else {
+        fatal("TODO Unimplemented hdmasource write during hblank dma\n");
+    }
+}
+
+void Memory::write_hdma2(u16, u8 val) {
+    if (hdmaBytesLeft == 0) {
+        hdmaSource = (hdmaSource & 0xFF00) | (val & 0xF0);
+    } else {
+        fatal("TODO Unimplemented hdmasource write during hblank dma\n");
+    }
+}
+
+void Memory::write_hdma3(u16, u8 val) {
+    if (hdmaBytesLeft == 0) {
+        hdmaDest = 0x8000 | (val & 0x1F) << 8 | (hdmaDest & 0xFF);
+    } else {
+        fatal("TODO Unimplemented hdmadest write during hblank dma\n");
+    }
+}
+
+void Memory::write_hdma4(u16, u8 val) {
+    if (hdmaBytesLeft == 0) {
+        hdmaDest = (hdmaDest & 0xFF00) | (val & 0xF0);
+    } else {
+        fatal("TODO Unimplemented hdmadest write during hblank dma\n");
+    }
+}
+
+void Memory::write_hdma5(u16, u8 val) {
+    if (hdmaBytesLeft > 0 && (val & 0x80) == 0) {
+        hdmaBytesLeft = 0;
         return;
     }
-    if (!is_CGB()) {
-        if (0xFF4C <= addr && addr <= 0xFF7F) {
-            return;
-        }
+    if ((hdmaSource >= 0x8000 && hdmaSource < 0xA000) || hdmaSource > 0xDFF0) {
+        fatal("TODO Unverified hdma source - %04x\n", hdmaSource);
     }
-    switch (addr) {
-        case IOReg::JOYP_REG:
-            mem[addr] = 0xC0 | (val & 0x30) | (mem[addr] & 0x0F);
-            break;
-        case IOReg::SB_REG:
-            mem[addr] = val;
-            break;
-        case IOReg::SC_REG:
-            mem[addr] = (val & (1 << 8)) | 0x7E | (val & 1);
-            if (is_CGB_mode() && (val & (1 << 1))) {
-                fatal("TODO serial clock speed unimplemented for CGB");
-            }
-            if ((val & 0x81) == 0x81) {
-                serial->trigger_transfer();
-            }
-            break;
-        case IOReg::DIV_REG:
-            timer->reset_div();
-            break;
-        case IOReg::TIMA_REG:
-            timer->write_tima(val);
-            break;
-        case IOReg::TMA_REG:
-            timer->write_tma(val);
-            break;
-        case IOReg::TAC_REG:
-            timer->write_tac(val);
-            mem[addr] = 0xF8 | val;
-            break;
-        case IOReg::IF_REG:
-            mem[addr] = 0xE0 | (val & 0x1F);
-            break;
-        case IOReg::LCDC_REG:
-        case IOReg::STAT_REG:
-        case IOReg::LYC_REG:
-            ppu->write_register(addr, val);
-            break;
-        case IOReg::DMA_REG:
-            // TODO verify this. According to docs, val >= 0xE0 is undefined behavior
-            if (val >= 0xE0) {
-                val &= ~0x20;
-            }
-            scheduleDma = true;  // DMA idles for 1 cycle before starting
-            dmaStartAddr = val << 8;
-            mem[addr] = val;
-            break;
-        case 0xFF4C:
-            break;
-        case IOReg::KEY1_REG:
-            if (val & 0x1) {
-                prepareSpeedSwitch = true;
-            }
-            if (cartridge->is_CGB_mode()) {
-                mem[addr] = (isDoubleSpeed << 7) | 0x7E | (val & 0x1);
-            }
-            break;
-        case 0xFF4E:
-            break;
-        case IOReg::VBK_REG:
-            if (is_CGB_mode()) {
-                ppu->write_vbk(val);
-                mem[addr] = 0xFE | val;
-            }
-            break;
-        case 0xFF50:
-            break;
-        case IOReg::HDMA1_REG:
-            if (hdmaBytesLeft == 0) {
-                hdmaSource = (val << 8) | (hdmaSource & 0xFF);
-            } else {
-                fatal("TODO Unimplemented hdmasource write during hblank dma\n");
-            }
-            break;
-        case IOReg::HDMA2_REG:
-            if (hdmaBytesLeft == 0) {
-                hdmaSource = (hdmaSource & 0xFF00) | (val & 0xF0);
-            } else {
-                fatal("TODO Unimplemented hdmasource write during hblank dma\n");
-            }
-            break;
-        case IOReg::HDMA3_REG:
-            if (hdmaBytesLeft == 0) {
-                hdmaDest = 0x8000 | (val & 0x1F) << 8 | (hdmaDest & 0xFF);
-            } else {
-                fatal("TODO Unimplemented hdmadest write during hblank dma\n");
-            }
-            break;
-        case IOReg::HDMA4_REG:
-            if (hdmaBytesLeft == 0) {
-                hdmaDest = (hdmaDest & 0xFF00) | (val & 0xF0);
-            } else {
-                fatal("TODO Unimplemented hdmadest write during hblank dma\n");
-            }
-            break;
-        case IOReg::HDMA5_REG: {
-            if (is_CGB_mode()) {
-                if (hdmaBytesLeft > 0 && (val & 0x80) == 0) {
-                    hdmaBytesLeft = 0;
-                    break;
-                }
-                if ((hdmaSource >= 0x8000 && hdmaSource < 0xA000) || hdmaSource > 0xDFF0) {
-                    fatal("TODO Unverified hdma source - %04x\n", hdmaSource);
-                }
-                hdmaBytesLeft = ((val & 0x7F) + 1) << 4;
-                if (val & 0x80) {
-                    // TODO according to Antonio docs and BGB, there is a 4 clock (1 nop) fixed
-                    // setup overhead
-                    fatal("TODO hblank dma is disabled since it needs to be tested more\n");
-                    continue_hblank_dma();
-                    mem[IOReg::HDMA5_REG] &= ~0x80;
-                } else {
-                    hdmaLen = hdmaBytesLeft;
-                    hdma2ClockCnt = hdmaLen;
-                }
-            }
-            break;
-        }
-        case IOReg::RP_REG: {
-            if (is_CGB_mode()) {
-                // Emulates IR port as if there is no external read
-                // IR port details: https://shonumi.github.io/dandocs.html#ir
+    hdmaBytesLeft = ((val & 0x7F) + 1) << 4;
+    if (val & 0x80) {
+        // TODO according to Antonio docs and BGB, there is a 4 clock (1 nop) fixed
+        // setup overhead
+        fatal("TODO hblank dma is disabled since it needs to be tested more\n");
+        continue_hblank_dma();
+        mem[IOReg::HDMA5_REG] &= ~0x80;
+    } else {
+        hdmaLen = hdmaBytesLeft;
+        hdma2ClockCnt = hdmaLen;
+        scheduler.schedule(Event::HDMA, 0);
+    }
+}
+
+void Memory::write_rp(u16, [[maybe_unused]] u8 val) {
+    // Emulates IR port as if there is no external read
+    // IR port details: https://shonumi.github.io/dandocs.html#ir
 #if DEBUG && LOG
-                if (val & 0x1) {
-                    printf("Infared light ON\n");
-                } else {
-                    printf("Infared light OFF\n");
-                }
-                if (val >> 6) {
-                    printf("Infared port read enabled\n");
-                } else {
-                    printf("Infared port read disabled\n");
-                }
-#endif
-                mem[addr] = (val & 0xC1) | 0x3E;
-            }
-            break;
-        }
-        case IOReg::BGPI_REG:
-        case IOReg::BGPD_REG:
-        case IOReg::OBPI_REG:
-        case IOReg::OBPD_REG:
-            ppu->write_register(addr, val);
-            break;
-        case IOReg::OPRI_REG:
-            break;
-        case IOReg::SVBK_REG:
-            if (is_CGB_mode()) {
-                u8 bank = (val & 0x7);
-                curWramBank = &wramBanks[bank == 0 ? 1 : bank];
-                mem[addr] = 0xF8 | val;
-            }
-            break;
-        case 0xFF71:
-            break;
-        case 0xFF74:
-            break;
-        case 0xFF75:
-            mem[addr] = val | 0x8F;
-            break;
-        case IOReg::PCM12_REG:
-        case IOReg::PCM34_REG:
-            break;
-        default:
-            mem[addr] = val;
+    if (val & 0x1) {
+        printf("Infared light ON\n");
+    } else {
+        printf("Infared light OFF\n");
     }
+    if (val >> 6) {
+        printf("Infared port read enabled\n");
+    } else {
+        printf("Infared port read disabled\n");
+    }
+#endif
+}
+
+void Memory::write_palette(u16 addr, u8 val) {
+    sync_ppu();
+    ppu->write_register(addr, val);
+    schedule_ppu();
+}
+
+void Memory::write_svbk(u16, u8 val) {
+    u8 bank = (val & 0x7);
+    curWramBank = &wramBanks[bank == 0 ? 1 : bank];
+    map_wram();
 }
 
 void Memory::start_speed_switch() {
+    sync_timer();
     timer->reset_div();
-    speedSwitchCycleCnt = 0x8000;
+    schedule_timer();
+
+    isSpeedSwitching = true;
+    scheduler.schedule(Event::SPEED_SWITCH, 0x8000 - 1);
 }
 
-bool Memory::is_speed_switching() { return speedSwitchCycleCnt > 0; }
+bool Memory::is_speed_switching() { return isSpeedSwitching; }
+
+void Memory::emulate_speed_switch() {
+    // PPU and APU clocks up to this cycle still run at the old speed
+    sync_ppu();
+    sync_apu();
 
-void Memory::emulate_speed_switch_cycle() {
-    if (is_speed_switching()) {
-        speedSwitchCycleCnt--;
-        if (speedSwitchCycleCnt == 0) {
-            isDoubleSpeed = !isDoubleSpeed;
-            prepareSpeedSwitch = false;
-            mem[IOReg::KEY1_REG] = (isDoubleSpeed << 7) | 0x7E;
+    isDoubleSpeed = !isDoubleSpeed;
+    prepareSpeedSwitch = false;
+    isSpeedSwitching = false;
+    clocksPerCycle = 4 >> (is_CGB_mode() && isDoubleSpeed);
+    mem[IOReg::KEY1_REG] = (isDoubleSpeed << 7) | 0x7E;
 #if DEBUG && LOG
-            printf("Speed switch to %d\n", isDoubleSpeed);
+    printf("Speed switch to %d\n", isDoubleSpeed);
 #endif
-        }
-    }
+
+    scheduler.cancel(Event::SPEED_SWITCH);
+    schedule_ppu();
 }
 
 void Memory::emulate_dma_cycle() {
@@ -383,7 +531,7 @@ void Memory::emulate_dma_cycle() {
         if (i == 0) {
             dmaInProgress = true;
         }
-        mem[0xFE00 + i] = read(dmaStartAddr + i);
+        ppu->write_oam(0xFE00 + i, read(dmaStartAddr + i));
         dmaCycleCnt--;
     }
     if (scheduleDma) {
@@ -431,18 +579,109 @@ int Memory::get_elapsed_cycles() { return elapsedCycles; }
 
 void Memory::reset_elapsed_cycles() { elapsedCycles -= PPU::TOTAL_CLOCKS << isDoubleSpeed; }
 
-void Memory::sleep_cycle() {
-    cartridge->emulate_cycle();
-    emulate_dma_cycle();
-    timer->emulate_cycle();
-    serial->emulate_cycle();
-    for (int i = 0; i < 4 >> (is_CGB_mode() && isDoubleSpeed); i++) {
-        apu->emulate_clock();
-        ppu->emulate_clock();
-        if (i % 2 == 1) {
-            emulate_hdma_2clock();
+void Memory::sync_cartridge() { cartridge->skip_cycles(scheduler.sync(Event::CARTRIDGE)); }
+
+void Memory::sync_timer() { timer->skip_cycles(scheduler.sync(Event::TIMER)); }
+
+void Memory::sync_serial() { serial->skip_cycles(scheduler.sync(Event::SERIAL)); }
+
+void Memory::sync_ppu() { ppu->skip_clocks(scheduler.sync(Event::PPU) * clocksPerCycle); }
+
+// The APU only runs when its registers or wave RAM are accessed and at the end of the frame
+void Memory::sync_apu() { apu->emulate_clocks(scheduler.sync(Event::APU) * clocksPerCycle); }
+
+void Memory::schedule_cartridge() {
+    scheduler.schedule(Event::CARTRIDGE, cartridge->get_idle_cycles());
+}
+
+void Memory::schedule_timer() { scheduler.schedule(Event::TIMER, timer->get_idle_cycles()); }
+
+void Memory::schedule_serial() { scheduler.schedule(Event::SERIAL, serial->get_idle_cycles()); }
+
+void Memory::schedule_ppu() {
+    u32 idleClocks = ppu->get_idle_clocks();
+    if (idleClocks == Scheduler::NEVER) {
+        scheduler.cancel(Event::PPU);
+    } else {
+        // The PPU has to be emulated clock by clock during the cycle containing its next state
+        scheduler.schedule(Event::PPU, idleClocks / clocksPerCycle);
+    }
+}
+
+void Memory::schedule_events() {
+    schedule_cartridge();
+    schedule_timer();
+    schedule_serial();
+    schedule_ppu();
+    scheduler.update_next_event();
+}
+
+// Components which are not due only count down during this cycle and catch up when synced
+void Memory::emulate_events() {
+    numEventCycles++;
+    if (scheduler.is_due(Event::CARTRIDGE)) {
+        cartridge->skip_cycles(scheduler.sync(Event::CARTRIDGE) - 1);
+        cartridge->emulate_cycle();
+        schedule_cartridge();
+    }
+    if (scheduler.is_due(Event::DMA)) {
+        emulate_dma_cycle();
+        if (dmaInProgress || dmaCycleCnt > 0 || scheduleDma) {
+            scheduler.schedule(Event::DMA, 0);
+        } else {
+            scheduler.cancel(Event::DMA);
+        }
+    }
+    if (scheduler.is_due(Event::TIMER)) {
+        timer->skip_cycles(scheduler.sync(Event::TIMER) - 1);
+        timer->emulate_cycle();
+        schedule_timer();
+    }
+    if (scheduler.is_due(Event::SERIAL)) {
+        serial->skip_cycles(scheduler.sync(Event::SERIAL) - 1);
+        serial->emulate_cycle();
+        schedule_serial();
+    }
+    if (scheduler.is_due(Event::PPU) || scheduler.is_due(Event::HDMA)) {
+        ppu->skip_clocks((scheduler.sync(Event::PPU) - 1) * clocksPerCycle);
+        for (int i = 0; i < clocksPerCycle; i++) {
+            ppu->emulate_clock();
+            if (i % 2 == 1) {
+                emulate_hdma_2clock();
+            }
         }
+        schedule_ppu();
+        if (is_hdma_ongoing()) {
+            scheduler.schedule(Event::HDMA, 0);
+        } else {
+            scheduler.cancel(Event::HDMA);
+        }
+    }
+    if (scheduler.is_due(Event::SPEED_SWITCH)) {
+        emulate_speed_switch();
+    }
+    scheduler.update_next_event();
+}
+
+void Memory::sleep_cycle() {
+    if (scheduler.tick()) {
+        emulate_events();
     }
-    emulate_speed_switch_cycle();
     elapsedCycles += 4;
 }
+
+// Machine cycles before the next event or the end of the frame, in which nothing is emulated
+u32 Memory::get_idle_cycles() {
+    int frameCycles = ((PPU::TOTAL_CLOCKS << isDoubleSpeed) - elapsedCycles) / 4;
+    if (frameCycles <= 0) {
+        return 0;
+    }
+    u32 idleCycles = scheduler.get_idle_cycles();
+    return idleCycles < (u32)frameCycles ? idleCycles : (u32)frameCycles;
+}
+
+// Fast forwards through idle cycles in which the CPU doesn't access memory
+void Memory::skip_cycles(u32 numCycles) {
+    scheduler.skip(numCycles);
+    elapsedCycles += (int)numCycles * 4;
+}
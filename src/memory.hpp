@@ -7,7 +7,9 @@
 #include "debugger.hpp"
 #include "general.hpp"
 #include "input.hpp"
+#include "interrupt_controller.hpp"
 #include "ppu.hpp"
+#include "scheduler.hpp"
 #include "serial.hpp"
 #include "timer.hpp"
 
@@ -32,12 +34,18 @@ public:
     bool is_CGB_mode() { return cartridge->is_CGB_mode(); }
     bool is_DMG_mode() { return cartridge->is_DMG_mode(); }
 
-    void request_interrupt(Interrupt interrupt);
+    void request_interrupt(Interrupt interrupt) { interrupts.request(interrupt); }
+    u8 get_interrupt_flags() { return interrupts.get_flags(); }
+    u8 get_pending_interrupts() { return interrupts.get_pending(); }
 
     u8& ref(u16 addr);
     u8 read(u16 addr);
     void write(u16 addr, u8 val);
 
+    void map_vram(u8* readBank, u8* writeBank);
+    const u8* get_read_page(u16 addr) { return readPages[addr >> 12]; }
+    u32 get_write_count(u16 addr) { return writeCounts[addr >> 8]; }
+
     bool is_double_speed() { return isDoubleSpeed; }
     bool should_speed_switch() { return prepareSpeedSwitch; }
     void start_speed_switch();
@@ -48,15 +56,64 @@ public:
 
     int get_elapsed_cycles();
     void reset_elapsed_cycles();
+    void schedule_events();
     void sleep_cycle();
+    void sync_apu();
+
+    u64 get_cycle() { return scheduler.get_cycle(); }
+    u32 get_event_cycles() { return numEventCycles; }
+    u32 get_idle_cycles();
+    void skip_cycles(u32 numCycles);
 
 private:
-    void emulate_speed_switch_cycle();
+    void map_cartridge();
+    void map_wram();
+    void map_io_registers();
+
+    u8 read_joyp(u16 addr);
+    u8 read_div(u16 addr);
+    u8 read_apu(u16 addr);
+    u8 read_pcm12(u16 addr);
+    u8 read_pcm34(u16 addr);
+
+    void write_if(u16 addr, u8 val);
+    void write_sc(u16 addr, u8 val);
+    void write_div(u16 addr, u8 val);
+    void write_tima(u16 addr, u8 val);
+    void write_tma(u16 addr, u8 val);
+    void write_tac(u16 addr, u8 val);
+    void write_apu(u16 addr, u8 val);
+    void write_wave(u16 addr, u8 val);
+    void write_lcd(u16 addr, u8 val);
+    void write_dma(u16 addr, u8 val);
+    void write_key1(u16 addr, u8 val);
+    void write_vbk(u16 addr, u8 val);
+    void write_hdma1(u16 addr, u8 val);
+    void write_hdma2(u16 addr, u8 val);
+    void write_hdma3(u16 addr, u8 val);
+    void write_hdma4(u16 addr, u8 val);
+    void write_hdma5(u16 addr, u8 val);
+    void write_rp(u16 addr, u8 val);
+    void write_palette(u16 addr, u8 val);
+    void write_svbk(u16 addr, u8 val);
+
+    void emulate_events();
+    void emulate_speed_switch();
     void emulate_dma_cycle();
     void emulate_hdma_2clock();
 
+    void sync_cartridge();
+    void sync_timer();
+    void sync_serial();
+    void sync_ppu();
+    void schedule_cartridge();
+    void schedule_timer();
+    void schedule_serial();
+    void schedule_ppu();
+
 private:
     friend class Debugger;
+    friend class Recompiler;
     Debugger* debugger;
 
     Cartridge* cartridge;
@@ -70,13 +127,37 @@ private:
     static constexpr int MEMORY_SIZE = 0x10000;
     u8 mem[MEMORY_SIZE];
 
+    // Host memory backing each 4 KiB page, nullptr if accesses to the page must be handled
+    static constexpr int PAGE_SIZE = 0x1000;
+    static constexpr int NUM_PAGES = MEMORY_SIZE / PAGE_SIZE;
+    u8* readPages[NUM_PAGES];
+    u8* writePages[NUM_PAGES];
+    u32 writeCounts[MEMORY_SIZE >> 8];  // writes to each mapped 256 byte chunk, to detect stale code
+
+    // I/O registers 0xFF00-0xFF7F, rebuilt for the current mode on restart. Writes store the
+    // writable bits to mem before calling the handler, reads without a handler return mem.
+    using IOReadHandler = u8 (Memory::*)(u16 addr);
+    using IOWriteHandler = void (Memory::*)(u16 addr, u8 val);
+    struct IORegister {
+        IOReadHandler read;
+        IOWriteHandler write;
+        u8 writeMask;  // bits stored to mem on write
+        u8 readMask;   // bits which always read as 1
+    };
+    IORegister ioRegs[0x80];
+
     using WRAMBank = u8[0x1000];
     WRAMBank* curWramBank;
     WRAMBank wramBanks[8];  // WRAM banks 1-7
 
+    Scheduler scheduler;
+    InterruptController interrupts;
+    u8 clocksPerCycle;  // PPU and APU clocks per machine cycle
+    u32 numEventCycles;  // cycles in which scheduled events were emulated
+
     bool isDoubleSpeed;
     bool prepareSpeedSwitch;
-    int speedSwitchCycleCnt;
+    bool isSpeedSwitching;
 
     bool dmaInProgress;
     bool scheduleDma;
@@ -1,17 +1,34 @@
 #include "ppu.hpp"
 
 #include "game_boy.hpp"
+#include "scheduler.hpp"
 
 void SpriteList::clear() {
     size = 0;
     removedBitField = 0;
+    first = 0;
 }
 
-void SpriteList::add(Sprite&& sprite) { data[size++] = sprite; }
+void SpriteList::add(Sprite&& sprite) {
+    u8 i = size++;
+    for (; i > 0 && data[i - 1].x > sprite.x; i--) {
+        data[i] = data[i - 1];
+    }
+    data[i] = sprite;
+}
 
-void SpriteList::remove(u8 index) { removedBitField |= 1 << index; }
+void SpriteList::remove(u8 index) {
+    removedBitField |= 1 << index;
+    while (first < size && is_removed(first)) {
+        first++;
+    }
+}
 
-PPU::PPU(Memory& memory) : memory(&memory) {
+PPU::PPU(Memory& memory)
+    : memory(&memory),
+      pixelFormat(PixelFormat::ARGB8888),
+      numFrameBuffers(0),
+      renderRequested(true) {
     lcdc = &memory.ref(IOReg::LCDC_REG);
     stat = &memory.ref(IOReg::STAT_REG);
     scy = &memory.ref(IOReg::SCY_REG);
@@ -25,16 +42,37 @@ PPU::PPU(Memory& memory) : memory(&memory) {
 }
 
 void PPU::restart() {
-    bufferSel = 0;
-    for (int i = 0; i < Constants::WIDTH * Constants::HEIGHT; i++) {
-        (frameBuffers[0])[i] = BLANK_COLOR;
-        (frameBuffers[1])[i] = BLANK_COLOR;
+    cgbMode = memory->is_CGB_mode();
+
+    u32 blankColor = pixelFormat == PixelFormat::INDEXED8 ? 0 : to_pixel_format(BLANK_COLOR);
+    for (u8 i = 0; i < numFrameBuffers; i++) {
+        for (int j = 0; j < Constants::WIDTH * Constants::HEIGHT; j++) {
+            write_pixel(frameBuffers[i], j, blankColor);
+        }
     }
+    curFrameBufferIndex = 0;
+    curFrameBuffer = numFrameBuffers > 0 ? frameBuffers[0] : nullptr;
+    renderFrame = renderRequested && numFrameBuffers > 0;
+    frameWorker.restart();
+    pendingFrame = nullptr;
 
     bgAutoIncrement = true;
     bgPaletteIndex = 0;
+    rebuild_colors();
+
+    for (int i = 0; i < Constants::HEIGHT; i++) {
+        spriteLineMasks[0][i] = 0;
+        spriteLineMasks[1][i] = 0;
+    }
+    for (u8 i = 0; i < NUM_SPRITES; i++) {
+        update_sprite_lines(i, oamAddrBlock[i << 2], true);
+    }
 
     curVramBank = &tileMapVram;
+    for (u16 addr = 0; addr < TILE_DATA_SIZE; addr += 2) {
+        decode_tile_row(tileRows[0][addr >> 1], tileMapVram[addr], tileMapVram[addr + 1]);
+        decode_tile_row(tileRows[1][addr >> 1], tileAttribVram[addr], tileAttribVram[addr + 1]);
+    }
 
     line = 0x99;
     curPPUState = PPUState::V_BLANK;
@@ -46,6 +84,7 @@ void PPU::restart() {
     oamBlockWrite = false;
     vramBlockRead = false;
     vramBlockWrite = false;
+    map_vram();
 
     statIntrFlags = 0;
     prevIntrFlags = 0;
@@ -53,11 +92,16 @@ void PPU::restart() {
 }
 
 void PPU::write_register(u16 addr, u8 val) {
+    if (curPPUState == PPUState::LCD_PRERENDERED && addr != IOReg::STAT_REG &&
+        addr != IOReg::LYC_REG && addr != IOReg::BGPI_REG && addr != IOReg::OBPI_REG) {
+        rewind_prerendered_line();
+    }
     switch (addr) {
         case IOReg::LCDC_REG: {
             bool lcdOn = (val & (1 << 7));
             if (lcdOn && !get_lcdc_flag(LCDCFlag::LCD_ENABLE)) {
                 curPPUState = PPUState::OAM;
+                renderFrame = renderRequested && numFrameBuffers > 0;
                 // TODO for some reason, turning lcd on using ldh (ff00) causes ldh to take effect
                 // immediately
                 lineClocks = 4;  // Hack to enable correct lcd on timing
@@ -79,6 +123,7 @@ void PPU::write_register(u16 addr, u8 val) {
                 oamBlockWrite = false;
                 vramBlockRead = false;
                 vramBlockWrite = false;
+                map_vram();
             }
             *lcdc = val;
         } break;
@@ -93,6 +138,18 @@ void PPU::write_register(u16 addr, u8 val) {
             try_lyc_intr();
             try_trigger_stat();
         } break;
+        case IOReg::BGP_REG:
+        case IOReg::OBP0_REG:
+        case IOReg::OBP1_REG:
+            update_dmg_palette((u8)(addr - IOReg::BGP_REG), val);
+            memory->ref(addr) = val;
+            break;
+        case IOReg::SCY_REG:
+        case IOReg::SCX_REG:
+        case IOReg::WY_REG:
+        case IOReg::WX_REG:
+            memory->ref(addr) = val;
+            break;
         case IOReg::LYC_REG:
             *lyc = val;
             if (get_lcdc_flag(LCDCFlag::LCD_ENABLE)) {
@@ -107,6 +164,7 @@ void PPU::write_register(u16 addr, u8 val) {
             break;
         case IOReg::BGPD_REG:
             bgPaletteData[bgPaletteIndex] = val;
+            update_cgb_color(bgColors, bgPaletteData, bgPaletteIndex);
             if (bgAutoIncrement) {
                 bgPaletteIndex = (bgPaletteIndex + 1) & 0x3F;
             }
@@ -117,6 +175,7 @@ void PPU::write_register(u16 addr, u8 val) {
             break;
         case IOReg::OBPD_REG:
             obPaletteData[obPaletteIndex] = val;
+            update_cgb_color(obColors, obPaletteData, obPaletteIndex);
             if (obAutoIncrement) {
                 obPaletteIndex = (obPaletteIndex + 1) & 0x3F;
             }
@@ -124,18 +183,80 @@ void PPU::write_register(u16 addr, u8 val) {
     }
 }
 
-void PPU::write_vbk(u8 val) { curVramBank = (val == 0) ? &tileMapVram : &tileAttribVram; }
+void PPU::write_vbk(u8 val) {
+    curVramBank = (val == 0) ? &tileMapVram : &tileAttribVram;
+    map_vram();
+}
+
+void PPU::map_vram() {
+    u8* vram = *curVramBank;
+    // Writes always go through write_vram to keep the decoded tile data up to date
+    memory->map_vram(vramBlockRead ? nullptr : vram, nullptr);
+}
+
+void PPU::decode_tile_row(TileRow& row, u8 data0, u8 data1) {
+    row.colors = 0;
+    row.flippedColors = 0;
+    for (int i = 0; i < TILE_PX_SIZE; i++) {
+        u32 col = ((data1 >> i) & 0x1) << 1 | ((data0 >> i) & 0x1);
+        row.flippedColors |= (u16)(col << (i << 1));
+        row.colors |= (u16)(col << ((TILE_PX_SIZE - 1 - i) << 1));
+    }
+}
+
+void PPU::fetch_tile_row(bool bank, u16 tileByteAddr) {
+    // The sprite fetcher can start between the background tile reads, so data0 may belong to a
+    // different row than data1
+    if (fetcher.data0Addr == (bank << 13 | tileByteAddr)) {
+        fetcher.row = &tileRows[bank][tileByteAddr >> 1];
+    } else {
+        decode_tile_row(fetcher.mixedRow, fetcher.data0, fetcher.data1);
+        fetcher.row = &fetcher.mixedRow;
+    }
+}
 
 void PPU::write_vram(u16 addr, u8 val) {
     if (0x8000 <= addr && addr < 0xA000) {
         if (!vramBlockWrite) {
-            (*curVramBank)[addr - 0x8000] = val;
+            VRAMBank& bank = *curVramBank;
+            u16 vramAddr = addr - 0x8000;
+            bank[vramAddr] = val;
+            if (vramAddr < TILE_DATA_SIZE) {
+                u16 rowAddr = vramAddr & 0x1FFE;
+                decode_tile_row(tileRows[curVramBank == &tileAttribVram][rowAddr >> 1],
+                                bank[rowAddr], bank[rowAddr + 1]);
+            }
         }
     } else {
         fatal("Invalid VRAM write address: %04x\n", addr);
     }
 }
 
+void PPU::write_oam(u16 addr, u8 val) {
+    u8 offset = (u8)(addr - OAM_START_ADDR);
+    if ((offset & 0x3) == 0) {
+        update_sprite_lines(offset >> 2, oamAddrBlock[offset], false);
+        update_sprite_lines(offset >> 2, val, true);
+    }
+    oamAddrBlock[offset] = val;
+}
+
+void PPU::update_sprite_lines(u8 oamIndex, u8 y, bool visible) {
+    for (int height = 8; height <= 16; height += 8) {
+        u64* masks = spriteLineMasks[height == 16];
+        // Lines where line + 16 - height < y <= line + 16
+        for (int i = y - 16; i < y - 16 + height; i++) {
+            if (0 <= i && i < Constants::HEIGHT) {
+                if (visible) {
+                    masks[i] |= (u64)1 << oamIndex;
+                } else {
+                    masks[i] &= ~((u64)1 << oamIndex);
+                }
+            }
+        }
+    }
+}
+
 u8 PPU::read_vram(u16 addr) {
     if (0x8000 <= addr && addr < 0xA000) {
         if (vramBlockRead) {
@@ -151,10 +272,38 @@ bool PPU::is_oam_read_blocked() { return oamBlockRead; }
 
 bool PPU::is_oam_write_blocked() { return oamBlockWrite; }
 
-void PPU::render(u32* pixelBuffer) {
-    FrameBuffer* curBuffer = &frameBuffers[!bufferSel];
-    for (int i = 0; i < Constants::WIDTH * Constants::HEIGHT; i++) {
-        pixelBuffer[i] = (*curBuffer)[i];
+void PPU::set_frame_buffers(void* const* buffers, u8 numBuffers, FrameCallback onFrame,
+                            void* userData) {
+    if (numBuffers == 0 || numBuffers > MAX_FRAME_BUFFERS) {
+        fatal("Invalid number of frame buffers: %d\n", numBuffers);
+    }
+    for (u8 i = 0; i < numBuffers; i++) {
+        frameBuffers[i] = buffers[i];
+    }
+    numFrameBuffers = numBuffers;
+    curFrameBufferIndex = 0;
+    curFrameBuffer = frameBuffers[0];
+    frameCallback = onFrame;
+    frameCallbackData = userData;
+}
+
+void PPU::set_threaded(bool threaded) {
+    if (threaded && numFrameBuffers < 3) {
+        fatal("Threaded frames need at least 3 frame buffers\n");
+    }
+    if (!threaded && pendingFrame) {
+        frameWorker.wait();
+        frameCallback(frameCallbackData, pendingFrame, frameWorker.get_info());
+        pendingFrame = nullptr;
+    }
+    frameWorker.set_threaded(threaded);
+}
+
+void PPU::set_pixel_format(PixelFormat format) {
+    if (format != pixelFormat) {
+        pixelFormat = format;
+        rebuild_colors();
+        frameWorker.invalidate();
     }
 }
 
@@ -208,23 +357,17 @@ void PPU::emulate_clock() {
             break;
         case PPUState::OAM_PRE_1:
             vramBlockRead = true;
+            map_vram();
             curPPUState = PPUState::OAM;
             break;
-        case PPUState::OAM:
+        case PPUState::OAM: {
             spriteList.clear();
-            for (u8 i = 0; i < 40; i++) {
+            u64 lineMask = spriteLineMasks[get_lcdc_flag(LCDCFlag::SPRITE_SIZE)][line];
+            while (lineMask && spriteList.size < SpriteList::MAX_SPRITES) {
+                u8 i = (u8)__builtin_ctzll(lineMask);
+                lineMask &= lineMask - 1;
                 u8* spritePtr = &oamAddrBlock[i << 2];
-                u8 y = *spritePtr;
-                u8 x = *(spritePtr + 1);
-
-                u8 botBound = line + 16;
-                u8 spriteHeight = get_lcdc_flag(LCDCFlag::SPRITE_SIZE) ? 16 : 8;
-                if (x >= 0 && botBound - spriteHeight < y && y <= botBound) {
-                    u8 tileID = *(spritePtr + 2);
-                    u8 flags = *(spritePtr + 3);
-                    spriteList.add({i, y, x, tileID, flags});
-                    if (spriteList.size == SpriteList::MAX_SPRITES) break;
-                }
+                spriteList.add({i, spritePtr[0], spritePtr[1], spritePtr[2], spritePtr[3]});
             }
 
             fetcher.curFetchState = 0;
@@ -241,7 +384,7 @@ void PPU::emulate_clock() {
             oamBlockWrite = false;  // OAM is momentarily accessible after oam mode
             curPPUState = PPUState::LCD_4;
             clockCnt = 4;
-            break;
+        } break;
         case PPUState::LCD_4:
             set_stat_mode(LCD_MODE);
             clear_stat_mode_intr(OAM_MODE);
@@ -250,38 +393,26 @@ void PPU::emulate_clock() {
             oamBlockWrite = true;
             vramBlockWrite = true;
             vramBlockRead = true;
+            map_vram();
             curPPUState = PPUState::LCD_5;
             clockCnt = 1;
             break;
         case PPUState::LCD_5:
             // Fetcher firt grabs tile 1 in 6 cycles but trashes it. Since the tile
             // is trashed, we simplify this by filling the fifo with garbage values.
-            for (int i = 0; i < 8; i++) {
-                bgFifo.push_tail({0, DMGPalette::BGP, false});
-            }
+            bgFifo.push(0, DMGPalette::BGP, false);
             curPPUState = PPUState::LCD;
+            prerender_line();
             break;
         case PPUState::LCD:
-            handle_pixel_render();
-
-            if (bgFifo.size < 8 || (fetcher.curSprite && bgFifo.size <= 8)) {
-                background_fetch();
-                fetcher.curFetchState = (fetcher.curFetchState + 1) & 0x7;
-            }
-            if (fetcher.curSprite && bgFifo.size > 8) {
-                sprite_fetch();
-                fetcher.curFetchState = (fetcher.curFetchState + 1) & 0x7;
-            }
+            emulate_pixel_transfer();
             if (curPixelX == Constants::WIDTH) {
-                set_stat_mode(H_BLANK_MODE);
-
-                fetcher.windowXEnable = false;
-                memory->continue_hblank_dma();
-
-                curPPUState = PPUState::H_BLANK_4;
-                clockCnt = 3;  // LCD lasts for one extra clock during hblank
+                end_pixel_transfer();
             }
             break;
+        case PPUState::LCD_PRERENDERED:
+            end_pixel_transfer();
+            break;
         case PPUState::H_BLANK_4:
             try_mode_intr(H_BLANK_MODE);
             internalStatEnable |= 1;
@@ -291,6 +422,7 @@ void PPU::emulate_clock() {
             oamBlockWrite = false;
             vramBlockRead = false;
             vramBlockWrite = false;
+            map_vram();
 
             curPPUState = PPUState::H_BLANK;
             clockCnt = SCAN_LINE_CLOCKS - lineClocks;
@@ -304,7 +436,9 @@ void PPU::emulate_clock() {
             if (line >= Constants::HEIGHT) {
                 curPPUState = PPUState::V_BLANK_144_4;
                 clockCnt = 4;
-                bufferSel = !bufferSel;
+                if (renderFrame) {
+                    finish_frame();
+                }
             } else {
                 oamBlockRead = true;
                 curPPUState = PPUState::OAM_3;
@@ -375,6 +509,7 @@ void PPU::emulate_clock() {
                 clockCnt = 4;
             } else {
                 line = 0;
+                renderFrame = renderRequested && numFrameBuffers > 0;
 
                 oamBlockRead = true;
                 curPPUState = PPUState::OAM_3;
@@ -384,6 +519,113 @@ void PPU::emulate_clock() {
     }
 }
 
+// Renders the whole line ahead and idles until the end of mode 3. The pipeline only depends on
+// registers which rewind the line when written, so the result matches dot by dot rendering.
+void PPU::prerender_line() {
+    lineStart.fetcher = fetcher;
+    lineStart.bgFifo = bgFifo;
+    lineStart.spriteFifo = spriteFifo;
+    lineStart.spriteList = spriteList;
+    lineStart.curPixelX = curPixelX;
+
+    lineTransferClocks = 0;
+    while (curPixelX != Constants::WIDTH) {
+        if (lineTransferClocks == SCAN_LINE_CLOCKS) {
+            rewind_prerendered_line();  // Pipeline stalled, leave it to dot by dot rendering
+            return;
+        }
+        emulate_pixel_transfer();
+        lineTransferClocks++;
+    }
+    curPPUState = PPUState::LCD_PRERENDERED;
+    clockCnt = lineTransferClocks;
+}
+
+// Replays the prerendered line up to the current clock and continues dot by dot
+void PPU::rewind_prerendered_line() {
+    short elapsedClocks = curPPUState == PPUState::LCD_PRERENDERED
+                              ? (short)(lineTransferClocks - clockCnt)
+                              : 0;
+    fetcher = lineStart.fetcher;
+    bgFifo = lineStart.bgFifo;
+    spriteFifo = lineStart.spriteFifo;
+    spriteList = lineStart.spriteList;
+    curPixelX = lineStart.curPixelX;
+    for (short i = 0; i < elapsedClocks; i++) {
+        emulate_pixel_transfer();
+    }
+    curPPUState = PPUState::LCD;
+    clockCnt = 1;
+}
+
+void PPU::end_pixel_transfer() {
+    set_stat_mode(H_BLANK_MODE);
+
+    fetcher.windowXEnable = false;
+    memory->continue_hblank_dma();
+
+    curPPUState = PPUState::H_BLANK_4;
+    clockCnt = 3;  // LCD lasts for one extra clock during hblank
+}
+
+void PPU::finish_frame() {
+    u32 lineSize = (u32)(Constants::WIDTH * get_pixel_size());
+    if (frameWorker.is_threaded()) {
+        if (pendingFrame) {
+            frameWorker.wait();
+            frameCallback(frameCallbackData, pendingFrame, frameWorker.get_info());
+        }
+        frameWorker.submit(curFrameBuffer, lineSize);
+        pendingFrame = curFrameBuffer;
+    } else {
+        frameWorker.process(curFrameBuffer, lineSize);
+        frameCallback(frameCallbackData, curFrameBuffer, frameWorker.get_info());
+    }
+    curFrameBufferIndex = (u8)((curFrameBufferIndex + 1) % numFrameBuffers);
+    curFrameBuffer = frameBuffers[curFrameBufferIndex];
+}
+
+void PPU::emulate_pixel_transfer() {
+    if (cgbMode) {
+        emulate_pixel_transfer<true>();
+    } else {
+        emulate_pixel_transfer<false>();
+    }
+}
+
+// One clock of the pixel pipeline, specialized on CGB mode since it runs for every dot
+template <bool CGB>
+void PPU::emulate_pixel_transfer() {
+    handle_pixel_render<CGB>();
+
+    if (bgFifo.size < 8 || (fetcher.curSprite && bgFifo.size <= 8)) {
+        background_fetch<CGB>();
+        fetcher.curFetchState = (fetcher.curFetchState + 1) & 0x7;
+    }
+    if (fetcher.curSprite && bgFifo.size > 8) {
+        sprite_fetch<CGB>();
+        fetcher.curFetchState = (fetcher.curFetchState + 1) & 0x7;
+    }
+}
+
+// Number of upcoming clocks where emulate_clock() would only count down to the next state. While
+// the LCD is off there is no next state, and v-blank lines only have states where LY and the
+// coincidence flag change, so both are skipped by the scheduler without per dot calls.
+u32 PPU::get_idle_clocks() {
+    if (!get_lcdc_flag(LCDCFlag::LCD_ENABLE)) {
+        return Scheduler::NEVER;
+    }
+    return clockCnt > 1 ? (u32)(clockCnt - 1) : 0;
+}
+
+void PPU::skip_clocks(u32 clocks) {
+    if (!get_lcdc_flag(LCDCFlag::LCD_ENABLE)) {
+        return;
+    }
+    lineClocks += (short)clocks;
+    clockCnt -= (short)clocks;
+}
+
 void PPU::set_stat_mode(PPUMode statMode) { *stat = (*stat & ~0x3) | statMode; }
 
 void PPU::update_coincidence() { *stat = (*stat & ~0x4) | ((*ly == *lyc) << 2); }
@@ -418,7 +660,6 @@ void PPU::try_trigger_stat() {
 }
 
 // Color correction formula found at https://near.sh/articles/video/color-emulation
-// TODO calculate color correction when loaded into palette memory
 u32 PPU::color_correction(u8 r, u8 g, u8 b) {
     int ri = r * 26 + g * 4 + b * 2;
     int gi = g * 24 + b * 8;
@@ -429,12 +670,93 @@ u32 PPU::color_correction(u8 r, u8 g, u8 b) {
     return 0xFF000000 | (u32)(r8 << 0x10) | (u32)(g8 << 0x8) | b8;
 }
 
+u32 PPU::to_pixel_format(u32 argb) {
+    if (pixelFormat == PixelFormat::RGB565) {
+        return ((argb >> 8) & 0xF800) | ((argb >> 5) & 0x07E0) | ((argb >> 3) & 0x001F);
+    }
+    if (pixelFormat == PixelFormat::GRAY8) {
+        u32 r = (argb >> 0x10) & 0xFF;
+        u32 g = (argb >> 0x8) & 0xFF;
+        u32 b = argb & 0xFF;
+        return (r * 77 + g * 150 + b * 29) >> 8;  // BT.601 weights
+    }
+    return argb;
+}
+
+u8 PPU::get_pixel_size() {
+    switch (pixelFormat) {
+        case PixelFormat::ARGB8888:
+            return 4;
+        case PixelFormat::RGB565:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+void PPU::write_pixel(void* frame, int index, u32 col) {
+    switch (pixelFormat) {
+        case PixelFormat::ARGB8888:
+            static_cast<u32*>(frame)[index] = col;
+            break;
+        case PixelFormat::RGB565:
+            static_cast<u16*>(frame)[index] = (u16)col;
+            break;
+        case PixelFormat::GRAY8:
+        case PixelFormat::INDEXED8:
+            static_cast<u8*>(frame)[index] = (u8)col;
+            break;
+    }
+}
+
+void PPU::rebuild_colors() {
+    for (u8 i = 0; i < 64; i += 2) {
+        if (pixelFormat == PixelFormat::INDEXED8) {
+            bgColors[i >> 1] = i >> 1;
+            obColors[i >> 1] = 32 + (i >> 1);
+        } else {
+            update_cgb_color(bgColors, bgPaletteData, i);
+            update_cgb_color(obColors, obPaletteData, i);
+        }
+    }
+    for (u8 i = 0; i < 3; i++) {
+        update_dmg_palette(i, memory->ref(IOReg::BGP_REG + i));
+    }
+}
+
+void PPU::update_cgb_color(u32* colors, const u8* paletteData, u8 index) {
+    if (pixelFormat == PixelFormat::INDEXED8) {
+        return;  // Indices don't depend on the palette data
+    }
+    u8 colLo = paletteData[index & 0x3E];
+    u8 colHi = paletteData[index | 0x1];
+    u8 r = colLo & 0x1F;
+    u8 g = ((colHi & 3) << 3) | ((colLo & 0xE0) >> 5);
+    u8 b = (colHi & 0x7C) >> 2;
+    colors[index >> 1] = to_pixel_format(color_correction(r, g, b));
+}
+
+void PPU::update_dmg_palette(u8 paletteNum, u8 val) {
+    for (int i = 0; i < 4; i++) {
+        u8 shade = (val >> (i << 1)) & 0x3;
+        dmgColors[paletteNum][i] =
+            pixelFormat == PixelFormat::INDEXED8 ? shade : to_pixel_format(baseColors[shade]);
+    }
+}
+
+template <bool CGB>
+bool PPU::is_window_enabled() {
+    return get_lcdc_flag(LCDCFlag::WINDOW_ENABLE) &&
+           (CGB || get_lcdc_flag(LCDCFlag::BG_WINDOW_OR_PRIORITY_ENABLE));
+}
+
+template <bool CGB>
 void PPU::handle_pixel_render() {
     if (fetcher.curSprite) {
         return;
     }
     if (fetcher.windowMode && !fetcher.windowXEnable && curPixelX == *wx - 7) {
-        if (is_window_enabled()) {
+        if (is_window_enabled<CGB>()) {
             fetcher.curFetchState = 0;
 
             fetcher.tileX = 0;
@@ -447,30 +769,39 @@ void PPU::handle_pixel_render() {
             return;
         }
     }
-    if (get_lcdc_flag(LCDCFlag::SPRITE_ENABLE)) {
-        for (int i = 0; i < spriteList.size; i++) {
-            if ((spriteList.removedBitField & (1 << i)) != 0) continue;
-
-            Sprite* sprite = &spriteList.data[i];
-            if (sprite->x <= curPixelX + 8) {
-                fetcher.curSprite = sprite;
-                if (bgFifo.size >= 8) {
-                    fetcher.curFetchState = 0;
-                }
-                spriteList.remove(i);
-                return;
+    if (spriteList.first < spriteList.size &&
+        spriteList.data[spriteList.first].x <= curPixelX + 8 &&
+        get_lcdc_flag(LCDCFlag::SPRITE_ENABLE)) {
+        // Several sprites are due at once if sprites were disabled, lowest OAM index goes first
+        u8 next = spriteList.first;
+        for (u8 i = next + 1; i < spriteList.size && spriteList.data[i].x <= curPixelX + 8; i++) {
+            if (!spriteList.is_removed(i) &&
+                spriteList.data[i].oamIndex < spriteList.data[next].oamIndex) {
+                next = i;
             }
         }
+        fetcher.curSprite = &spriteList.data[next];
+        if (bgFifo.size >= 8) {
+            fetcher.curFetchState = 0;
+        }
+        spriteList.remove(next);
+        return;
     }
-    if (bgFifo.size > 0) {
+    if (bgFifo.size > 0 && !renderFrame) {
+        bgFifo.pop();
+        if (spriteFifo.size > 0) {
+            spriteFifo.pop();
+        }
+        curPixelX++;
+    } else if (bgFifo.size > 0) {
         bool isOBJPxl = false;
-        BGFIFOData bgPxl = bgFifo.pop_head();
+        BGFIFOData bgPxl = bgFifo.pop();
         u8 colIndex = bgPxl.colIndex;
         u8 paletteNum = bgPxl.paletteNum;
         if (spriteFifo.size > 0) {
-            SpriteFIFOData spritePxl = spriteFifo.pop_head();
+            SpriteFIFOData spritePxl = spriteFifo.pop();
             bool masterSpritePriority =
-                memory->is_CGB_mode() && !get_lcdc_flag(LCDCFlag::BG_WINDOW_OR_PRIORITY_ENABLE);
+                CGB && !get_lcdc_flag(LCDCFlag::BG_WINDOW_OR_PRIORITY_ENABLE);
             if (spritePxl.colIndex != 0) {
                 if (masterSpritePriority || (!bgPxl.priority && !spritePxl.priority) ||
                     colIndex == 0) {
@@ -483,35 +814,23 @@ void PPU::handle_pixel_render() {
 
         if (curPixelX >= 0) {
             u32 col;
-            if (memory->is_CGB_mode()) {
-                u8* paletteData = bgPaletteData;
-                if (isOBJPxl) {
-                    paletteData = obPaletteData;
-                }
-                u8 index = colIndex * 2 + 8 * paletteNum;
-                u8 colLo = paletteData[index];
-                u8 colHi = paletteData[index + 1];
-                u8 r = colLo & 0x1F;
-                u8 g = ((colHi & 3) << 3) | ((colLo & 0xE0) >> 5);
-                u8 b = (colHi & 0x7C) >> 2;
-                col = color_correction(r, g, b);
+            if (CGB) {
+                col = (isOBJPxl ? obColors : bgColors)[paletteNum * 4 + colIndex];
             } else {
-                u8 i = (colIndex & 0x3) << 1;
-                u8 mask = 3 << i;
-                u8 palette = memory->read(IOReg::BGP_REG + paletteNum);
-                col = baseColors[(palette & mask) >> i];
+                col = dmgColors[paletteNum][colIndex & 0x3];
             }
-            frameBuffers[bufferSel][line * Constants::WIDTH + curPixelX] = col;
+            write_pixel(curFrameBuffer, line * Constants::WIDTH + curPixelX, col);
         }
         curPixelX++;
     }
 }
 
+template <bool CGB>
 void PPU::background_fetch() {
     switch (fetcher.FETCH_STATES[fetcher.curFetchState]) {
         case Fetcher::READ_TILE_ID: {
             // TODO verify that flag is checked and turns off during READ_TILE_ID
-            if (fetcher.windowXEnable && !is_window_enabled()) {
+            if (fetcher.windowXEnable && !is_window_enabled<CGB>()) {
                 fetcher.windowXEnable = false;
             }
 
@@ -534,7 +853,7 @@ void PPU::background_fetch() {
             u16 tileIndexAddr = (tileX + tileY * TILESET_SIZE) + tileMap;
             fetcher.tileIndex = tileMapVram[tileIndexAddr];
 
-            if (memory->is_CGB_mode()) {
+            if (CGB) {
                 fetcher.tileAttribs = tileAttribVram[tileIndexAddr];
             }
         } break;
@@ -545,7 +864,7 @@ void PPU::background_fetch() {
             } else {
                 tileByteAddr = (u16)(0x1000 + (s8)fetcher.tileIndex * TILE_MEM_LEN);
             }
-            if (memory->is_CGB_mode()) {
+            if (CGB) {
                 u8 y = fetcher.yOff & 0x7;
                 if (fetcher.tileAttribs & (1 << 6)) {
                     tileByteAddr += (y ^ 0x7) << 1;
@@ -555,9 +874,9 @@ void PPU::background_fetch() {
             } else {
                 tileByteAddr += (fetcher.yOff % TILE_PX_SIZE) << 1;
             }
-            fetcher.data0 =
-                ((fetcher.tileAttribs & 0x8 && memory->is_CGB_mode()) ? tileAttribVram
-                                                                      : tileMapVram)[tileByteAddr];
+            bool bank = fetcher.tileAttribs & 0x8 && CGB;
+            fetcher.data0 = (bank ? tileAttribVram : tileMapVram)[tileByteAddr];
+            fetcher.data0Addr = (u16)(bank << 13 | tileByteAddr);
         } break;
         case Fetcher::READ_TILE_1: {
             u16 tileByteAddr;
@@ -566,7 +885,7 @@ void PPU::background_fetch() {
             } else {
                 tileByteAddr = (u16)(0x1000 + (s8)fetcher.tileIndex * TILE_MEM_LEN);
             }
-            if (memory->is_CGB_mode()) {
+            if (CGB) {
                 u8 y = fetcher.yOff & 0x7;
                 if (fetcher.tileAttribs & (1 << 6)) {
                     tileByteAddr += (y ^ 0x7) << 1;
@@ -576,34 +895,25 @@ void PPU::background_fetch() {
             } else {
                 tileByteAddr += (fetcher.yOff % TILE_PX_SIZE) << 1;
             }
-            fetcher.data1 = ((fetcher.tileAttribs & 0x8 && memory->is_CGB_mode())
-                                 ? tileAttribVram
-                                 : tileMapVram)[tileByteAddr + 1];
+            bool bank = fetcher.tileAttribs & 0x8 && CGB;
+            fetcher.data1 = (bank ? tileAttribVram : tileMapVram)[tileByteAddr + 1];
+            fetch_tile_row(bank, tileByteAddr);
         }
         case Fetcher::PUSH:
             if ((fetcher.curSprite && bgFifo.size <= 8) || bgFifo.size == 0) {
                 u8 palette;
-                if (memory->is_CGB_mode()) {
+                if (CGB) {
                     palette = fetcher.tileAttribs & 0x7;
                 } else {
                     palette = DMGPalette::BGP;
                 }
-                bool priority = memory->is_CGB_mode() && fetcher.tileAttribs & (1 << 7);
-                if (memory->is_CGB_mode() ||
-                    get_lcdc_flag(LCDCFlag::BG_WINDOW_OR_PRIORITY_ENABLE)) {
+                bool priority = CGB && fetcher.tileAttribs & (1 << 7);
+                if (CGB || get_lcdc_flag(LCDCFlag::BG_WINDOW_OR_PRIORITY_ENABLE)) {
                     bool xFlip = fetcher.tileAttribs & (1 << 5);
-                    for (int i = 0; i < TILE_PX_SIZE; i++) {
-                        u8 align = xFlip ? (1 << i) : (1 << 7) >> i;
-                        bool hi = fetcher.data1 & align;
-                        bool lo = fetcher.data0 & align;
-                        u8 col = (hi << 1) | lo;
-
-                        bgFifo.push_tail({col, palette, priority});
-                    }
+                    bgFifo.push(xFlip ? fetcher.row->flippedColors : fetcher.row->colors, palette,
+                                priority);
                 } else {
-                    for (int i = 0; i < TILE_PX_SIZE; i++) {
-                        bgFifo.push_tail({0, palette, priority});
-                    }
+                    bgFifo.push(0, palette, priority);
                 }
                 fetcher.tileX++;
                 fetcher.curFetchState = 7;
@@ -616,6 +926,7 @@ void PPU::background_fetch() {
     }
 }
 
+template <bool CGB>
 void PPU::sprite_fetch() {
     switch (fetcher.FETCH_STATES[fetcher.curFetchState]) {
         case Fetcher::READ_TILE_ID: {
@@ -632,9 +943,9 @@ void PPU::sprite_fetch() {
             } else {
                 tileByteAddr += y << 1;
             }
-            fetcher.data0 = ((fetcher.curSprite->flags & 0x8 && memory->is_CGB_mode())
-                                 ? tileAttribVram
-                                 : tileMapVram)[tileByteAddr];
+            bool bank = fetcher.curSprite->flags & 0x8 && CGB;
+            fetcher.data0 = (bank ? tileAttribVram : tileMapVram)[tileByteAddr];
+            fetcher.data0Addr = (u16)(bank << 13 | tileByteAddr);
         } break;
         case Fetcher::READ_TILE_1: {
             u16 tileByteAddr = fetcher.curSprite->tileID * TILE_MEM_LEN;
@@ -645,38 +956,37 @@ void PPU::sprite_fetch() {
             } else {
                 tileByteAddr += y << 1;
             }
-            fetcher.data1 = ((fetcher.curSprite->flags & 0x8 && memory->is_CGB_mode())
-                                 ? tileAttribVram
-                                 : tileMapVram)[tileByteAddr + 1];
+            bool bank = fetcher.curSprite->flags & 0x8 && CGB;
+            fetcher.data1 = (bank ? tileAttribVram : tileMapVram)[tileByteAddr + 1];
+            fetch_tile_row(bank, tileByteAddr);
         }
         case Fetcher::PUSH: {
             bool bgPriority = fetcher.curSprite->flags & (1 << 7);
             u8 palette;
-            if (memory->is_CGB_mode()) {
+            if (CGB) {
                 palette = fetcher.curSprite->flags & 0x7;
             } else {
                 palette = ((fetcher.curSprite->flags & (1 << 4)) != 0) + DMGPalette::OBP0;
             }
             bool xFlip = fetcher.curSprite->flags & (1 << 5);
+            u16 colors = xFlip ? fetcher.row->flippedColors : fetcher.row->colors;
             u8 fifoSize = spriteFifo.size;
-            for (int i = 0; i < TILE_PX_SIZE; i++) {
-                u8 align = xFlip ? (1 << i) : (1 << 7) >> i;
-                bool hi = fetcher.data1 & align;
-                bool lo = fetcher.data0 & align;
-                u8 col = (hi << 1) | lo;
+            for (u8 i = 0; i < TILE_PX_SIZE; i++) {
+                u8 col = (colors >> (i << 1)) & 0x3;
 
                 SpriteFIFOData cur = {col, palette, bgPriority, fetcher.curSprite->oamIndex};
                 if (fifoSize > i) {
                     if (col != 0) {
                         // Sprites with lower oam index are rendered on top in GBC
+                        SpriteFIFOData prev = spriteFifo.get(i);
                         bool oamIndexPriority = ((memory->read(IOReg::OPRI_REG) & 0x1) == 0 &&
-                                                 spriteFifo.get(i)->oamIndex > cur.oamIndex);
-                        if (oamIndexPriority || spriteFifo.get(i)->colIndex == 0) {
-                            spriteFifo.set(i, std::move(cur));
+                                                 prev.oamIndex > cur.oamIndex);
+                        if (oamIndexPriority || prev.colIndex == 0) {
+                            spriteFifo.set(i, cur);
                         }
                     }
                 } else {
-                    spriteFifo.push_tail(std::move(cur));
+                    spriteFifo.push_tail(cur);
                 }
             }
             fetcher.curSprite = nullptr;
@@ -688,8 +998,3 @@ void PPU::sprite_fetch() {
 }
 
 bool PPU::get_lcdc_flag(LCDCFlag flag) { return *lcdc & (1 << (u8)flag); }
-
-bool PPU::is_window_enabled() {
-    return get_lcdc_flag(LCDCFlag::WINDOW_ENABLE) &&
-           (memory->is_CGB_mode() || get_lcdc_flag(LCDCFlag::BG_WINDOW_OR_PRIORITY_ENABLE));
-}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "frame_worker.hpp"
 #include "general.hpp"
 
 class Memory;
@@ -13,15 +14,24 @@ struct Sprite {
     u8 flags;
 };
 
+// Sprites of a line sorted by x, sprites with the same x stay in OAM order
 struct SpriteList {
     void clear();
     void add(Sprite&& sprite);
     void remove(u8 index);
+    bool is_removed(u8 index) { return (removedBitField & (1 << index)) != 0; }
 
     static constexpr u8 MAX_SPRITES = 10;
     Sprite data[MAX_SPRITES];
     u16 removedBitField = 0;
     u8 size = 0;
+    u8 first = 0;  // leftmost sprite which isn't removed
+};
+
+// One row of a tile decoded to packed 2-bit color indices, pixel i at bits 2i-2i+1
+struct TileRow {
+    u16 colors;         // left to right
+    u16 flippedColors;  // right to left
 };
 
 struct Fetcher {
@@ -89,6 +99,9 @@ struct Fetcher {
     u8 tileAttribs;
     u8 data0;
     u8 data1;
+    u16 data0Addr;  // vram bank << 13 | address of data0
+    const TileRow* row;
+    TileRow mixedRow;  // decoded from data0 and data1 when they belong to different rows
 };
 
 enum DMGPalette : u8 {
@@ -108,6 +121,70 @@ struct SpriteFIFOData {
     u8 oamIndex;
 };
 
+// Pixel fifos are shift registers with the head pixel in the lowest bits. Colors take 2 bits per
+// pixel, palette and priority are packed into the attributes as palette | priority << 3.
+struct BGFIFO {
+    void clear() {
+        colors = 0;
+        attribs = 0;
+        size = 0;
+    }
+    // Pushes a row of 8 pixels sharing the same attributes
+    void push(u16 rowColors, u8 paletteNum, bool priority) {
+        colors |= (u32)rowColors << (size << 1);
+        attribs |= (u64)((u32)(paletteNum | priority << 3) * 0x11111111) << (size << 2);
+        size += 8;
+    }
+    BGFIFOData pop() {
+        BGFIFOData pixel = {(u8)(colors & 0x3), (u8)(attribs & 0x7), (attribs & 0x8) != 0};
+        colors >>= 2;
+        attribs >>= 4;
+        size--;
+        return pixel;
+    }
+
+    u32 colors;
+    u64 attribs;  // 4 bits per pixel
+    u8 size;
+};
+
+// Holds at most 8 pixels, since sprites are only pushed to a fifo with 8 or less pixels
+struct SpriteFIFO {
+    void clear() {
+        colors = 0;
+        attribs = 0;
+        oamIndices = 0;
+        size = 0;
+    }
+    SpriteFIFOData get(u8 index) {
+        u8 attrib = (u8)(attribs >> (index << 3));
+        return {(u8)((colors >> (index << 1)) & 0x3), (u8)(attrib & 0x7), (attrib & 0x8) != 0,
+                (u8)(oamIndices >> (index << 3))};
+    }
+    void set(u8 index, const SpriteFIFOData& pixel) {
+        u8 colorShift = index << 1;
+        u8 byteShift = index << 3;
+        colors = (u16)((colors & ~(0x3 << colorShift)) | pixel.colIndex << colorShift);
+        attribs = (attribs & ~((u64)0xFF << byteShift)) |
+                  (u64)(pixel.paletteNum | pixel.priority << 3) << byteShift;
+        oamIndices = (oamIndices & ~((u64)0xFF << byteShift)) | (u64)pixel.oamIndex << byteShift;
+    }
+    void push_tail(const SpriteFIFOData& pixel) { set(size++, pixel); }
+    SpriteFIFOData pop() {
+        SpriteFIFOData pixel = get(0);
+        colors >>= 2;
+        attribs >>= 8;
+        oamIndices >>= 8;
+        size--;
+        return pixel;
+    }
+
+    u16 colors;
+    u64 attribs;  // 8 bits per pixel
+    u64 oamIndices;
+    u8 size;
+};
+
 enum class LCDCFlag : u8 {
     BG_WINDOW_OR_PRIORITY_ENABLE = 0,
     SPRITE_ENABLE = 1,
@@ -134,6 +211,7 @@ enum class PPUState {
     LCD_4,
     LCD_5,
     LCD,
+    LCD_PRERENDERED,  // Line was rendered at the start of mode 3, waits for the end of mode 3
     H_BLANK_4,
     H_BLANK,
 
@@ -145,6 +223,19 @@ enum class PPUState {
     V_BLANK,
 };
 
+enum class PixelFormat : u8 {
+    ARGB8888,
+    RGB565,
+    // Luma of the corrected color, one byte per pixel
+    GRAY8,
+    // CGB: palette * 4 + color index, 0-31 for background and 32-63 for sprite palettes
+    // DMG: shade 0-3 after applying BGP/OBP0/OBP1
+    INDEXED8,
+};
+
+// Called on v-blank with the frame buffer that was just completed
+using FrameCallback = void (*)(void* userData, void* frame, const FrameInfo& info);
+
 class PPU {
 public:
     static constexpr int OAM_SEARCH_CLOCKS = 80;
@@ -154,6 +245,8 @@ public:
 
     static constexpr int TOTAL_CLOCKS = SCAN_LINE_CLOCKS * V_BLANK_END_LINE;
 
+    static constexpr u8 MAX_FRAME_BUFFERS = 4;
+
     PPU(Memory& memory);
     void restart();
     void set_debugger(Debugger& debug) { this->debugger = &debug; }
@@ -163,14 +256,33 @@ public:
 
     void write_vram(u16 addr, u8 val);
     u8 read_vram(u16 addr);
+    void write_oam(u16 addr, u8 val);
 
     bool is_oam_read_blocked();
     bool is_oam_write_blocked();
 
-    void render(u32* pixelBuffer);
+    // Lines are drawn directly into the caller owned buffers of WIDTH * HEIGHT pixels, moving on to
+    // the next buffer of the ring after each frame
+    void set_frame_buffers(void* const* buffers, u8 numBuffers, FrameCallback onFrame,
+                           void* userData);
+    // Takes effect from the next pixel, buffers must be large enough for the format
+    void set_pixel_format(PixelFormat format);
+    // Latched when a frame starts at line 0, frames started while rendering is disabled keep their
+    // timing but aren't drawn or passed to the frame callback
+    void set_rendering(bool render) { renderRequested = render; }
+    // Frames are hashed on a worker thread and passed to the frame callback one frame later, which
+    // needs at least 3 frame buffers. Pixels are still generated on the emulation thread.
+    void set_threaded(bool threaded);
     void emulate_clock();
+    u32 get_idle_clocks();
+    void skip_clocks(u32 clocks);
 
 private:
+    void map_vram();
+    void update_sprite_lines(u8 oamIndex, u8 y, bool visible);
+    void decode_tile_row(TileRow& row, u8 data0, u8 data1);
+    void fetch_tile_row(bool bank, u16 tileByteAddr);
+
     void set_stat_mode(PPUMode statMode);
     void update_coincidence();
     void clear_coincidence();
@@ -181,18 +293,38 @@ private:
     void try_trigger_stat();
 
     u32 color_correction(u8 r, u8 g, u8 b);
+    u32 to_pixel_format(u32 argb);
+    u8 get_pixel_size();
+    void write_pixel(void* frame, int index, u32 col);
+    void finish_frame();
+    void rebuild_colors();
+    void update_cgb_color(u32* colors, const u8* paletteData, u8 index);
+    void update_dmg_palette(u8 paletteNum, u8 val);
+
+    void prerender_line();
+    void rewind_prerendered_line();
+    void end_pixel_transfer();
+    void emulate_pixel_transfer();
+    template <bool CGB>
+    void emulate_pixel_transfer();
+    template <bool CGB>
     void handle_pixel_render();
 
+    template <bool CGB>
     void background_fetch();
+    template <bool CGB>
     void sprite_fetch();
 
     bool get_lcdc_flag(LCDCFlag flag);
+    template <bool CGB>
     bool is_window_enabled();
 
     friend class Debugger;
     Debugger* debugger;
     Memory* memory;
 
+    bool cgbMode;  // Selects the specialization of the pixel pipeline, fixed after restart
+
     u8* lcdc;
     u8* stat;
     u8* scy;
@@ -210,8 +342,17 @@ private:
     u8 obPaletteIndex;
     u8 obPaletteData[64];
 
+    // Output colors in pixelFormat indexed by palette * 4 + color index, rebuilt on palette writes
+    PixelFormat pixelFormat;
+    u32 bgColors[32];
+    u32 obColors[32];
+    u32 dmgColors[3][4];  // indexed by DMGPalette
+
     static constexpr u16 OAM_START_ADDR = 0xFE00;
+    static constexpr u8 NUM_SPRITES = 40;
     u8* oamAddrBlock;
+    // Bit i is set if sprite i is on the line, indexed by LCDC sprite size
+    u64 spriteLineMasks[2][Constants::HEIGHT];
 
     static constexpr u16 VRAM_START_ADDR = 0x8000;
     using VRAMBank = u8[0x2000];
@@ -219,9 +360,21 @@ private:
     VRAMBank tileMapVram;     // VRAM BANK 0
     VRAMBank tileAttribVram;  // VRAM BANK 1
 
-    using FrameBuffer = u32[160 * 144];
-    bool bufferSel;
-    FrameBuffer frameBuffers[2];
+    // Tile data 0x8000-0x97FF of both banks decoded to color indices, updated on VRAM writes
+    static constexpr u16 TILE_DATA_SIZE = 0x1800;
+    TileRow tileRows[2][TILE_DATA_SIZE / 2];
+
+    void* frameBuffers[MAX_FRAME_BUFFERS];
+    u8 numFrameBuffers;
+    u8 curFrameBufferIndex;
+    void* curFrameBuffer;
+    FrameCallback frameCallback;
+    void* frameCallbackData;
+    bool renderRequested;
+    bool renderFrame;  // latched from renderRequested at the start of each frame
+
+    FrameWorker frameWorker;
+    void* pendingFrame;  // frame being processed by the worker thread
 
     short lineClocks;
     short clockCnt;
@@ -234,9 +387,18 @@ private:
     static constexpr u8 TILE_PX_SIZE = 8;  // width and height of a tile in pixels
     Fetcher fetcher;
 
-    static constexpr u8 FIFO_SIZE = 16;
-    Queue<BGFIFOData, FIFO_SIZE> bgFifo;
-    Queue<SpriteFIFOData, FIFO_SIZE> spriteFifo;
+    BGFIFO bgFifo;
+    SpriteFIFO spriteFifo;
+
+    // Pixel pipeline at the start of mode 3, to replay a prerendered line up to a mid-line write
+    struct {
+        Fetcher fetcher;
+        BGFIFO bgFifo;
+        SpriteFIFO spriteFifo;
+        SpriteList spriteList;
+        short curPixelX;
+    } lineStart;
+    short lineTransferClocks;  // pixel transfer clocks of the prerendered line
 
     u8 lockedSCX;
 
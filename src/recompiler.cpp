@@ -0,0 +1,988 @@
+#include "recompiler.hpp"
+
+#include "block_cache.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+using namespace X64;
+
+// Native code keeps its state in callee saved registers:
+//   rbx = CPU, rbp = Memory, r12 = Recompiler, r14 = flag table
+//   r13d = frame limit, the op ends the block once elapsed cycles reach it
+//   r15d = value kept across the ticks of an instruction
+// rax, rcx, rdx and r8 are scratch and don't survive a tick or a memory access.
+namespace {
+#ifdef _WIN32
+constexpr Reg ARG0 = RCX;
+constexpr Reg ARG1 = RDX;
+constexpr Reg ARG2 = R8;
+#else
+constexpr Reg ARG0 = RDI;
+constexpr Reg ARG1 = RSI;
+constexpr Reg ARG2 = RDX;
+#endif
+// Shadow space of win64 calls, keeps rsp 16 byte aligned after the six pushes of the trampoline
+constexpr u32 FRAME_SIZE = 40;
+
+constexpr u8 FLAG_Z = 0x80;
+constexpr u8 FLAG_N = 0x40;
+constexpr u8 FLAG_H = 0x20;
+constexpr u8 FLAG_C = 0x10;
+
+s32 offset(const void* base, const void* field) {
+    return (s32)((const u8*)field - (const u8*)base);
+}
+
+template <typename Func>
+u64 func_addr(Func func) {
+    return reinterpret_cast<uintptr_t>(func);
+}
+}  // namespace
+
+Recompiler::Recompiler(CPU& cpu, Memory& memory)
+    : cpu(&cpu), memory(&memory), blocks(new Block[NUM_BLOCKS]) {
+    // lahf stores ZF, AF and CF in bits 6, 4 and 0
+    for (int i = 0; i < 0x100; i++) {
+        flagTable[i] = (u8)((i & 0x40) << 1 | (i & 0x10) << 1 | (i & 0x01) << 4);
+    }
+}
+
+bool Recompiler::init() {
+#if defined(__x86_64__) || defined(_M_X64)
+    if (emitter.is_initialized()) {
+        return true;
+    }
+    if (!emitter.init(BUFFER_SIZE)) {
+        return false;
+    }
+    emit_trampoline();
+    emit_stubs();
+    blocksStart = emitter.get_pos();
+    restart();
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Also used to flush the code buffer once it's full
+void Recompiler::restart() {
+    for (size_t i = 0; i < NUM_BLOCKS; i++) {
+        blocks[i].host = nullptr;
+    }
+    if (emitter.is_initialized()) {
+        emitter.rewind(blocksStart);
+    }
+    error = nullptr;
+    opFetched = false;
+}
+
+bool Recompiler::run() {
+    u64 startCycle = memory->get_cycle();
+    // Same restrictions as the block cache, see BlockCache::lookup
+    while (!(0x8000 <= cpu->PC && cpu->PC < 0xA000) && cpu->PC < 0xE000 && can_run()) {
+        curBlock = lookup(cpu->PC);
+        if (!curBlock) {
+            break;
+        }
+        cpu->materialize_flags();
+        u64 cycle = memory->get_cycle();
+        frameLimit = (u32)(PPU::TOTAL_CLOCKS << memory->is_double_speed());
+        enter(this, curBlock->code);
+        if (error) {
+            std::exception_ptr blockError = error;
+            error = nullptr;
+            std::rethrow_exception(blockError);
+        }
+        if (opFetched) {
+            opFetched = false;
+            cpu->execute_fetched();
+            return true;
+        }
+        if (memory->get_cycle() == cycle) {
+            break;
+        }
+    }
+    return memory->get_cycle() != startCycle;
+}
+
+// Native code doesn't handle interrupts or stalls and only checks the frame limit and the
+// next event, so everything else which can interrupt the instruction stream is checked here
+bool Recompiler::can_run() {
+    return !cpu->halted && !cpu->haltBug && !cpu->imeScheduled &&
+           !(cpu->ime && memory->get_pending_interrupts()) && !cpu->debugger->is_paused() &&
+           !memory->is_speed_switching() && !memory->is_hdma_ongoing();
+}
+
+Recompiler::Block* Recompiler::lookup(u16 pc) {
+    const u8* page = memory->get_read_page(pc);
+    if (!page) {
+        return nullptr;
+    }
+
+    const u8* host = page + (pc & 0xFFF);
+    uintptr_t hostAddr = (uintptr_t)host;
+    Block& block = blocks[(hostAddr ^ (hostAddr >> 14)) & (NUM_BLOCKS - 1)];
+    bool inRam = pc >= 0x8000;
+    u32 writeCount = memory->get_write_count(pc);
+    u8 numRecompiles = 0;
+    if (block.host == host && block.pc == pc) {
+        if (!inRam || block.writeCount == writeCount) {
+            return block.code ? &block : nullptr;
+        }
+        // Self-modifying code is left to the interpreter once it keeps changing
+        block.writeCount = writeCount;
+        if (block.numRecompiles >= MAX_RECOMPILES) {
+            block.code = nullptr;
+            return nullptr;
+        }
+        numRecompiles = (u8)(block.numRecompiles + 1);
+    }
+
+    if (emitter.get_free() < MAX_BLOCK_SIZE) {
+        restart();
+    }
+    block.host = host;
+    block.pc = pc;
+    block.inRam = inRam;
+    block.writeCount = writeCount;
+    block.numRecompiles = numRecompiles;
+    block.code = compile(pc, page, inRam);
+    return block.code ? &block : nullptr;
+}
+
+void Recompiler::emit_trampoline() {
+    enter = reinterpret_cast<EnterFunc>(reinterpret_cast<uintptr_t>(emitter.get_code(0)));
+    for (Reg reg : {RBX, RBP, R12, R13, R14, R15}) {
+        emitter.push(reg);
+    }
+    emitter.alu_imm(SUB, 64, RSP, FRAME_SIZE);
+    emitter.mov(64, R12, ARG0);
+    emitter.mov(64, RBX, self_field(&cpu));
+    emitter.mov(64, RBP, self_field(&memory));
+    emitter.mov(32, R13, self_field(&frameLimit));
+    emitter.mov(64, R14, R12);
+    emitter.alu_imm(ADD, 64, R14, (u32)offset(this, flagTable));
+    emitter.jmp(ARG1);
+
+    // Blocks exit with the next PC in eax
+    exitPos = emitter.get_pos();
+    emitter.mov(16, cpu_field(&cpu->PC), RAX);
+    emitter.alu_imm(ADD, 64, RSP, FRAME_SIZE);
+    for (Reg reg : {R15, R14, R13, R12, RBP, RBX}) {
+        emitter.pop(reg);
+    }
+    emitter.ret();
+}
+
+// Calls from blocks to the slow paths, which keep the stack aligned for the helpers
+void Recompiler::emit_stubs() {
+    eventsStub = emitter.get_pos();
+    emitter.alu_imm(SUB, 64, RSP, FRAME_SIZE);
+    emitter.mov(64, ARG0, R12);
+    emit_call_helper(func_addr(&Recompiler::handle_events));
+    emitter.alu_imm(ADD, 64, RSP, FRAME_SIZE);
+    emitter.ret();
+
+    readStub = emitter.get_pos();
+    emitter.alu_imm(SUB, 64, RSP, FRAME_SIZE);
+    emitter.movzx(16, ARG1, RAX);
+    emitter.mov(64, ARG0, R12);
+    emit_call_helper(func_addr(&Recompiler::read_slow));
+    emitter.movzx(8, RAX, RAX);
+    emitter.alu_imm(ADD, 64, RSP, FRAME_SIZE);
+    emitter.ret();
+
+    // The value is moved first since edx is the second argument on win64
+    writeStub = emitter.get_pos();
+    emitter.alu_imm(SUB, 64, RSP, FRAME_SIZE);
+    emitter.movzx(8, ARG2, RDX);
+    emitter.movzx(16, ARG1, RAX);
+    emitter.mov(64, ARG0, R12);
+    emit_call_helper(func_addr(&Recompiler::write_slow));
+    emitter.alu_imm(ADD, 64, RSP, FRAME_SIZE);
+    emitter.ret();
+}
+
+const u8* Recompiler::compile(u16 pc, const u8* page, bool inRam) {
+    size_t start = emitter.get_pos();
+    exits.clear();
+    compilingRam = inRam;
+    compilingChunk = pc >> 8;
+
+    u16 addr = pc;
+    int numOps = 0;
+    bool ended = false;
+    while (numOps < MAX_BLOCK_OPS && !ended) {
+        u8 opcode = page[addr & 0xFFF];
+        u8 length = BlockCache::get_op_length(opcode);
+        u16 lastAddr = (u16)(addr + length - 1);
+        if ((pc >> 12) != (lastAddr >> 12)) {
+            break;  // Next page may be mapped elsewhere
+        }
+        if (inRam && (pc >> 8) != (lastAddr >> 8)) {
+            break;  // Ram blocks are validated by a single write counter
+        }
+        u8 imm[2] = {length > 1 ? page[(addr + 1) & 0xFFF] : (u8)0,
+                     length > 2 ? page[(addr + 2) & 0xFFF] : (u8)0};
+
+        emit_prologue(addr);
+        ended = compile_op(addr, opcode, imm);
+        addr = (u16)(addr + length);
+        numOps++;
+    }
+    if (numOps == 0) {
+        emitter.rewind(start);
+        return nullptr;
+    }
+    if (!ended) {
+        emit_exit(addr);
+    }
+    for (const Exit& exit : exits) {
+        emitter.bind(exit.patch);
+        if (exit.fetched) {
+            emitter.alu_imm(ADD, 32, memory_field(&memory->elapsedCycles), 4);
+            emitter.mov_imm(8, self_field(&opFetched), 1);
+        }
+        emit_exit(exit.pc);
+    }
+    return emitter.get_code(start);
+}
+
+// Returns true if the op ends the block. Ticks happen in the same order as in CPU::execute.
+bool Recompiler::compile_op(u16 pc, u8 opcode, const u8* imm) {
+    u8 x = opcode >> 6;
+    u8 y = (opcode >> 3) & 0x7;
+    u8 z = opcode & 0x7;
+    u8 p = y >> 1;
+    bool q = y & 1;
+    u16 nn = (u16)(imm[0] | imm[1] << 8);
+    u16 next = (u16)(pc + BlockCache::get_op_length(opcode));
+
+    if (x == 1) {
+        if (opcode == 0x76) {  // HALT
+            compile_fallback(pc, opcode, imm, true);
+            return true;
+        }
+#if DEBUG && !LOG
+        if (opcode == 0x40) {  // LD B, B pauses the debugger
+            compile_fallback(pc, opcode, imm, true);
+            return true;
+        }
+#endif
+        if (y == z) {
+            return false;
+        }
+        if (z == 6) {  // LD r, (HL)
+            emit_tick();
+            emitter.movzx(16, RAX, reg16(2));
+            emit_read();
+            emitter.mov(8, reg8(y), RAX);
+        } else if (y == 6) {  // LD (HL), r
+            emit_tick();
+            emitter.movzx(16, RAX, reg16(2));
+            emitter.movzx(8, RDX, reg8(z));
+            emit_write();
+        } else {  // LD r, r
+            emitter.mov(8, RAX, reg8(z));
+            emitter.mov(8, reg8(y), RAX);
+        }
+        return false;
+    }
+    if (x == 2) {  // ALU A, r
+        if (z == 6) {
+            emit_tick();
+            emitter.movzx(16, RAX, reg16(2));
+            emit_read();
+            emitter.mov(32, RCX, RAX);
+        } else {
+            emitter.movzx(8, RCX, reg8(z));
+        }
+        emit_alu(y);
+        return false;
+    }
+
+    switch (opcode) {
+        case 0x00:  // NOP
+            return false;
+        case 0x08:  // LD (nn), SP
+            emit_tick();
+            emit_tick();
+            emit_tick();
+            emitter.movzx(8, RDX, cpu_field(&cpu->SP));
+            emit_write_const(nn);
+            emit_tick();
+            emitter.movzx(8, RDX, cpu_field((u8*)&cpu->SP + 1));
+            emit_write_const((u16)(nn + 1));
+            return false;
+        case 0x10:  // STOP
+            compile_fallback(pc, opcode, imm, true);
+            return true;
+        case 0x18:  // JR
+        case 0x20:
+        case 0x28:
+        case 0x30:
+        case 0x38: {
+            emit_tick();
+            size_t notTaken = 0;
+            if (opcode != 0x18) {
+                notTaken = emitter.jcc(emit_test_cond(y - 4));
+            }
+            u16 target = (u16)(next + (s8)imm[0]);
+            emit_tick();
+            if ((s8)imm[0] < 0) {
+                emitter.mov_imm(16, cpu_field(&cpu->PC), target);
+                emitter.mov_imm(32, ARG1, pc);
+                emitter.mov(64, ARG0, R12);
+                emit_call_helper(func_addr(&Recompiler::check_poll_loop));
+            }
+            emit_exit(target);
+            if (opcode == 0x18) {
+                return true;
+            }
+            emitter.bind(notTaken);
+            return false;
+        }
+        case 0x27:  // DAA
+            compile_fallback(pc, opcode, imm, false);
+            return false;
+        case 0x2F:  // CPL
+            emitter.alu_imm(XOR, 8, reg8(7), 0xFF);
+            emitter.alu_imm(OR, 8, cpu_field(&cpu->regs.F), FLAG_N | FLAG_H);
+            return false;
+        case 0x37:  // SCF
+            emitter.alu_imm(AND, 8, cpu_field(&cpu->regs.F), FLAG_Z);
+            emitter.alu_imm(OR, 8, cpu_field(&cpu->regs.F), FLAG_C);
+            return false;
+        case 0x3F:  // CCF
+            emitter.alu_imm(AND, 8, cpu_field(&cpu->regs.F), FLAG_Z | FLAG_C);
+            emitter.alu_imm(XOR, 8, cpu_field(&cpu->regs.F), FLAG_C);
+            return false;
+        case 0xC9:  // RET
+        case 0xD9:  // RETI
+            emit_pop();
+            emitter.mov(32, R15, RAX);
+            emit_tick();
+            if (opcode == 0xD9) {
+                emitter.mov_imm(8, cpu_field(&cpu->ime), 1);
+            }
+            emitter.mov(32, RAX, R15);
+            emit_exit_dynamic();
+            return true;
+        case 0xE9:  // JP HL
+            emitter.movzx(16, RAX, reg16(2));
+            emit_exit_dynamic();
+            return true;
+        case 0xF9:  // LD SP, HL
+            emitter.movzx(16, RAX, reg16(2));
+            emitter.mov(16, reg16(3), RAX);
+            emit_tick();
+            return false;
+        case 0xC3:  // JP nn
+            emit_tick();
+            emit_tick();
+            emit_tick();
+            emit_exit(nn);
+            return true;
+        case 0xCB:
+            compile_cb(imm[0]);
+            return false;
+        case 0xCD:  // CALL nn
+            emit_tick();
+            emit_tick();
+            emitter.mov_imm(32, R15, next);
+            emit_push();
+            emit_exit(nn);
+            return true;
+        case 0xE0:  // LDH (n), A
+            emit_tick();
+            emit_tick();
+            emitter.movzx(8, RDX, reg8(7));
+            emit_write_const((u16)(0xFF00 + imm[0]));
+            return false;
+        case 0xF0:  // LDH A, (n)
+            emit_tick();
+            emit_tick();
+            emit_read_const((u16)(0xFF00 + imm[0]));
+            emitter.mov(8, reg8(7), RAX);
+            return false;
+        case 0xE2:  // LDH (C), A
+            emit_tick();
+            emitter.movzx(8, RAX, reg8(1));
+            emitter.alu_imm(OR, 32, RAX, 0xFF00);
+            emitter.movzx(8, RDX, reg8(7));
+            emit_write();
+            return false;
+        case 0xF2:  // LDH A, (C)
+            emit_tick();
+            emitter.movzx(8, RAX, reg8(1));
+            emitter.alu_imm(OR, 32, RAX, 0xFF00);
+            emit_read();
+            emitter.mov(8, reg8(7), RAX);
+            return false;
+        case 0xEA:  // LD (nn), A
+            emit_tick();
+            emit_tick();
+            emit_tick();
+            emitter.movzx(8, RDX, reg8(7));
+            emit_write_const(nn);
+            return false;
+        case 0xFA:  // LD A, (nn)
+            emit_tick();
+            emit_tick();
+            emit_tick();
+            emit_read_const(nn);
+            emitter.mov(8, reg8(7), RAX);
+            return false;
+        case 0xE8:  // ADD SP, n
+        case 0xF8:  // LD HL, SP + n
+            compile_fallback(pc, opcode, imm, false);
+            return false;
+        case 0xF3:  // DI
+            emitter.mov_imm(8, cpu_field(&cpu->ime), 0);
+            return false;
+        case 0xFB:  // EI, interrupts are checked before the next op
+            emitter.mov_imm(8, cpu_field(&cpu->imeScheduled), 1);
+            emit_exit(next);
+            return true;
+        default:
+            break;
+    }
+
+    if (x == 0) {
+        switch (z) {
+            case 1:
+                if (!q) {  // LD rr, nn
+                    emit_tick();
+                    emit_tick();
+                    emitter.mov_imm(16, reg16(p), nn);
+                } else {  // ADD HL, rr
+                    emitter.movzx(16, RAX, reg16(2));
+                    emitter.movzx(16, RCX, reg16(p));
+                    emitter.mov(32, RDX, RAX);
+                    emitter.alu(ADD, 32, RDX, RCX);
+                    emitter.mov(16, reg16(2), RDX);
+                    // Carries out of bit 11 and 15 end up in bit 12 and 16 of a ^ b ^ sum
+                    emitter.alu(XOR, 32, RCX, RAX);
+                    emitter.alu(XOR, 32, RCX, RDX);
+                    emitter.mov(32, RAX, RCX);
+                    emitter.shift(SHR, 32, RAX, 7);
+                    emitter.alu_imm(AND, 32, RAX, FLAG_H);
+                    emitter.shift(SHR, 32, RCX, 12);
+                    emitter.alu_imm(AND, 32, RCX, FLAG_C);
+                    emitter.alu(OR, 32, RAX, RCX);
+                    emitter.movzx(8, RCX, cpu_field(&cpu->regs.F));
+                    emitter.alu_imm(AND, 32, RCX, FLAG_Z);
+                    emitter.alu(OR, 32, RAX, RCX);
+                    emitter.mov(8, cpu_field(&cpu->regs.F), RAX);
+                    emit_tick();
+                }
+                return false;
+            case 2: {  // LD (rr), A and LD A, (rr)
+                emit_tick();
+                emitter.movzx(16, RAX, reg16(p < 2 ? p : 2));
+                if (p == 2) {
+                    emitter.inc(16, reg16(2));
+                } else if (p == 3) {
+                    emitter.dec(16, reg16(2));
+                }
+                if (!q) {
+                    emitter.movzx(8, RDX, reg8(7));
+                    emit_write();
+                } else {
+                    emit_read();
+                    emitter.mov(8, reg8(7), RAX);
+                }
+                return false;
+            }
+            case 3:  // INC rr and DEC rr
+                if (!q) {
+                    emitter.inc(16, reg16(p));
+                } else {
+                    emitter.dec(16, reg16(p));
+                }
+                emit_tick();
+                return false;
+            case 4:  // INC r
+            case 5:  // DEC r
+                if (y == 6) {
+                    emit_tick();
+                    emitter.movzx(16, RAX, reg16(2));
+                    emit_read();
+                } else {
+                    emitter.movzx(8, RAX, reg8(y));
+                }
+                if (z == 4) {
+                    emitter.inc(8, RAX);
+                } else {
+                    emitter.dec(8, RAX);
+                }
+                emit_flags(z == 5, true);
+                if (y == 6) {
+                    emitter.mov(32, R15, RAX);
+                    emit_tick();
+                    emitter.movzx(16, RAX, reg16(2));
+                    emitter.mov(32, RDX, R15);
+                    emit_write();
+                } else {
+                    emitter.mov(8, reg8(y), RAX);
+                }
+                return false;
+            case 6:  // LD r, n
+                emit_tick();
+                if (y == 6) {
+                    emit_tick();
+                    emitter.movzx(16, RAX, reg16(2));
+                    emitter.mov_imm(32, RDX, imm[0]);
+                    emit_write();
+                } else {
+                    emitter.mov_imm(8, reg8(y), imm[0]);
+                }
+                return false;
+            case 7: {  // RLCA, RRCA, RLA and RRA
+                if (y >= 2) {
+                    emitter.movzx(8, RCX, cpu_field(&cpu->regs.F));
+                    emitter.shift(SHR, 8, RCX, 5);  // Carry flag to CF
+                }
+                emitter.mov(8, RAX, reg8(7));
+                static constexpr ShiftOp ROTATES[] = {ROL, ROR, RCL, RCR};
+                emitter.shift(ROTATES[y], 8, RAX, 1);
+                emitter.mov(8, reg8(7), RAX);
+                emit_shift_flags(false);
+                return false;
+            }
+            default:
+                break;
+        }
+    }
+
+    if (x == 3) {
+        if (z == 6) {  // ALU A, n
+            emit_tick();
+            emitter.mov_imm(32, RCX, imm[0]);
+            emit_alu(y);
+            return false;
+        }
+        if (z == 7) {  // RST
+            emitter.mov_imm(32, R15, next);
+            emit_push();
+            emit_exit((u16)(y << 3));
+            return true;
+        }
+        if (z == 1 && !q) {  // POP rr
+            emit_pop();
+            if (p == 3) {
+                emitter.alu_imm(AND, 32, RAX, 0xFFF0);
+                emitter.movzx(8, RCX, cpu_field(&cpu->regs.F));
+                emitter.alu_imm(AND, 32, RCX, 0x0F);
+                emitter.alu(OR, 32, RAX, RCX);
+                emitter.mov(16, cpu_field(&cpu->regs.AF), RAX);
+            } else {
+                emitter.mov(16, reg16(p), RAX);
+            }
+            return false;
+        }
+        if (z == 5 && !q) {  // PUSH rr
+            emitter.movzx(16, R15, p == 3 ? cpu_field(&cpu->regs.AF) : reg16(p));
+            emit_push();
+            return false;
+        }
+        if (y < 4) {
+            if (z == 0) {  // RET cc
+                emit_tick();
+                size_t notTaken = emitter.jcc(emit_test_cond(y));
+                emit_pop();
+                emitter.mov(32, R15, RAX);
+                emit_tick();
+                emitter.mov(32, RAX, R15);
+                emit_exit_dynamic();
+                emitter.bind(notTaken);
+                return false;
+            }
+            if (z == 2) {  // JP cc, nn
+                emit_tick();
+                emit_tick();
+                size_t notTaken = emitter.jcc(emit_test_cond(y));
+                emit_tick();
+                emit_exit(nn);
+                emitter.bind(notTaken);
+                return false;
+            }
+            if (z == 4) {  // CALL cc, nn
+                emit_tick();
+                emit_tick();
+                size_t notTaken = emitter.jcc(emit_test_cond(y));
+                emitter.mov_imm(32, R15, next);
+                emit_push();
+                emit_exit(nn);
+                emitter.bind(notTaken);
+                return false;
+            }
+        }
+    }
+
+    // Invalid opcodes freeze the CPU
+    compile_fallback(pc, opcode, imm, true);
+    return true;
+}
+
+void Recompiler::compile_cb(u8 cbOp) {
+    u8 x = cbOp >> 6;
+    u8 y = (cbOp >> 3) & 0x7;
+    u8 z = cbOp & 0x7;
+
+    emit_tick();
+    if (z == 6) {
+        emit_tick();
+        emitter.movzx(16, RAX, reg16(2));
+        emit_read();
+    } else {
+        emitter.movzx(8, RAX, reg8(z));
+    }
+
+    switch (x) {
+        case 0:
+            if (y == 6) {  // SWAP
+                emitter.shift(ROL, 8, RAX, 4);
+                emitter.test(8, RAX, RAX);
+                emitter.setcc(E, RCX);
+                emitter.shift(SHL, 8, RCX, 7);
+                emitter.mov(8, cpu_field(&cpu->regs.F), RCX);
+            } else {  // RLC, RRC, RL, RR, SLA, SRA and SRL
+                if (y == 2 || y == 3) {
+                    emitter.movzx(8, RCX, cpu_field(&cpu->regs.F));
+                    emitter.shift(SHR, 8, RCX, 5);  // Carry flag to CF
+                }
+                static constexpr ShiftOp SHIFTS[] = {ROL, ROR, RCL, RCR, SHL, SAR, ROL, SHR};
+                emitter.shift(SHIFTS[y], 8, RAX, 1);
+                emit_shift_flags(true);
+            }
+            break;
+        case 1:  // BIT
+            emitter.test_imm(8, RAX, 1u << y);
+            emitter.setcc(E, RCX);
+            emitter.shift(SHL, 8, RCX, 7);
+            emitter.movzx(8, RDX, cpu_field(&cpu->regs.F));
+            emitter.alu_imm(AND, 32, RDX, FLAG_C);
+            emitter.alu(OR, 32, RCX, RDX);
+            emitter.alu_imm(OR, 32, RCX, FLAG_H);
+            emitter.mov(8, cpu_field(&cpu->regs.F), RCX);
+            return;
+        case 2:  // RES
+            emitter.alu_imm(AND, 8, RAX, (u8) ~(1u << y));
+            break;
+        case 3:  // SET
+            emitter.alu_imm(OR, 8, RAX, 1u << y);
+            break;
+    }
+
+    if (z == 6) {
+        emitter.mov(32, R15, RAX);
+        emit_tick();
+        emitter.movzx(16, RAX, reg16(2));
+        emitter.mov(32, RDX, R15);
+        emit_write();
+    } else {
+        emitter.mov(8, reg8(z), RAX);
+    }
+}
+
+// Ops which are rare or change the CPU state checked by can_run are executed by the
+// interpreter. Ops ending the block continue at the PC they left.
+void Recompiler::compile_fallback(u16 pc, u8 opcode, const u8* imm, bool endsBlock) {
+    emitter.mov_imm(32, ARG2, (u32)(opcode | imm[0] << 8 | imm[1] << 16));
+    emitter.mov_imm(32, ARG1, pc);
+    emitter.mov(64, ARG0, R12);
+    emit_call_helper(func_addr(&Recompiler::execute_op));
+    if (endsBlock) {
+        emitter.movzx(16, RAX, cpu_field(&cpu->PC));
+        emit_exit_dynamic();
+    }
+}
+
+Mem Recompiler::cpu_field(const void* field) { return mem(RBX, offset(cpu, field)); }
+
+Mem Recompiler::memory_field(const void* field) { return mem(RBP, offset(memory, field)); }
+
+Mem Recompiler::self_field(const void* field) { return mem(R12, offset(this, field)); }
+
+// Operand order of the opcode encoding, (HL) has no field
+Mem Recompiler::reg8(u8 index) {
+    u8* regs[] = {&cpu->regs.B, &cpu->regs.C, &cpu->regs.D, &cpu->regs.E,
+                  &cpu->regs.H, &cpu->regs.L, nullptr,       &cpu->regs.A};
+    return cpu_field(regs[index]);
+}
+
+Mem Recompiler::reg16(u8 index) {
+    u16* regs[] = {&cpu->regs.BC, &cpu->regs.DE, &cpu->regs.HL, &cpu->SP};
+    return cpu_field(regs[index]);
+}
+
+// Exits before the op once the frame is done or a helper stopped the block. Otherwise this is the
+// opcode fetch tick, if its events leave the state to the interpreter the block exits after it
+// and CPU::execute_fetched handles the interrupts and the op.
+void Recompiler::emit_prologue(u16 pc) {
+    Mem cycle = memory_field(&memory->scheduler.cycle);
+    emitter.alu(CMP, 32, memory_field(&memory->elapsedCycles), R13);
+    exits.push_back({emitter.jcc(GE), pc, false});
+    emitter.mov(64, RAX, cycle);
+    emitter.inc(64, RAX);
+    emitter.mov(64, cycle, RAX);
+    emitter.alu(CMP, 64, RAX, memory_field(&memory->scheduler.nextEventCycle));
+    size_t noEvent = emitter.jcc(B);
+    emitter.call_to(eventsStub);
+    emitter.alu_imm(CMP, 32, R13, STOP);
+    exits.push_back({emitter.jcc(E), pc, true});
+    emitter.bind(noEvent);
+    emitter.alu_imm(ADD, 32, memory_field(&memory->elapsedCycles), 4);
+}
+
+void Recompiler::emit_exit(u16 pc) {
+    emitter.mov_imm(32, RAX, pc);
+    emitter.jmp_to(exitPos);
+}
+
+void Recompiler::emit_exit_dynamic() { emitter.jmp_to(exitPos); }
+
+// Same as Memory::sleep_cycle
+void Recompiler::emit_tick() {
+    Mem cycle = memory_field(&memory->scheduler.cycle);
+    emitter.mov(64, RAX, cycle);
+    emitter.inc(64, RAX);
+    emitter.mov(64, cycle, RAX);
+    emitter.alu(CMP, 64, RAX, memory_field(&memory->scheduler.nextEventCycle));
+    size_t noEvent = emitter.jcc(B);
+    emitter.call_to(eventsStub);
+    emitter.bind(noEvent);
+    emitter.alu_imm(ADD, 32, memory_field(&memory->elapsedCycles), 4);
+}
+
+// Paged memory is accessed inline, the rest goes through Memory::read and Memory::write
+void Recompiler::emit_read() {
+    emitter.mov(32, RCX, RAX);
+    emitter.shift(SHR, 32, RCX, 12);
+    emitter.mov(64, RCX, mem(RBP, RCX, 8, offset(memory, memory->readPages)));
+    emitter.test(64, RCX, RCX);
+    size_t slow = emitter.jcc(E);
+    emitter.alu_imm(AND, 32, RAX, 0xFFF);
+    emitter.movzx(8, RAX, mem(RCX, RAX, 1, 0));
+    size_t done = emitter.jmp();
+    emitter.bind(slow);
+    emitter.call_to(readStub);
+    emitter.bind(done);
+}
+
+void Recompiler::emit_write() {
+    emitter.mov(32, RCX, RAX);
+    emitter.shift(SHR, 32, RCX, 12);
+    emitter.mov(64, RCX, mem(RBP, RCX, 8, offset(memory, memory->writePages)));
+    emitter.test(64, RCX, RCX);
+    size_t slow = emitter.jcc(E);
+    emitter.mov(32, R8, RAX);
+    emitter.shift(SHR, 32, R8, 8);
+    emitter.inc(32, mem(RBP, R8, 4, offset(memory, memory->writeCounts)));
+    emitter.alu_imm(AND, 32, RAX, 0xFFF);
+    emitter.mov(8, mem(RCX, RAX, 1, 0), RDX);
+    if (compilingRam) {
+        // The rest of a ram block may have been overwritten
+        emitter.alu_imm(CMP, 32, R8, compilingChunk);
+        size_t otherChunk = emitter.jcc(NE);
+        emitter.mov_imm(32, self_field(&frameLimit), STOP);
+        emitter.mov_imm(32, R13, STOP);
+        emitter.bind(otherChunk);
+    }
+    size_t done = emitter.jmp();
+    emitter.bind(slow);
+    emitter.call_to(writeStub);
+    emitter.bind(done);
+}
+
+// HRAM and registers without a read handler are read from mem like Memory::read does
+void Recompiler::emit_read_const(u16 addr) {
+    bool hram = addr >= 0xFF80;
+    bool plainIO = addr >= 0xFF00 && !hram && !memory->ioRegs[addr - 0xFF00].read;
+    if (!hram && !plainIO) {
+        emitter.mov_imm(32, RAX, addr);
+        emit_read();
+        return;
+    }
+    emitter.movzx(8, RAX, memory_field(&memory->mem[addr]));
+    if (plainIO && memory->ioRegs[addr - 0xFF00].readMask) {
+        emitter.alu_imm(OR, 32, RAX, memory->ioRegs[addr - 0xFF00].readMask);
+    }
+}
+
+void Recompiler::emit_write_const(u16 addr) {
+    if (0xFF80 <= addr && addr < IOReg::IE_REG) {
+        emitter.mov(8, memory_field(&memory->mem[addr]), RDX);
+        return;
+    }
+    emitter.mov_imm(32, RAX, addr);
+    emit_write();
+}
+
+// Returns the condition code which jumps if cc of the opcode isn't met
+Cond Recompiler::emit_test_cond(u8 cc) {
+    emitter.test_imm(8, cpu_field(&cpu->regs.F), cc < 2 ? FLAG_Z : FLAG_C);
+    return (cc & 1) ? E : NE;
+}
+
+// Operand in ecx
+void Recompiler::emit_alu(u8 op) {
+    static constexpr AluOp OPS[] = {ADD, ADC, SUB, SBB, AND, XOR, OR, CMP};
+    emitter.mov(8, RAX, reg8(7));
+    if (op == 1 || op == 3) {
+        emitter.movzx(8, RDX, cpu_field(&cpu->regs.F));
+        emitter.shift(SHR, 8, RDX, 5);  // Carry flag to CF
+    }
+    emitter.alu(OPS[op], 8, RAX, RCX);
+    if (op < 4 || op == 7) {
+        emit_flags(op >= 2, false);
+    } else {
+        emitter.setcc(E, RCX);
+        emitter.shift(SHL, 8, RCX, 7);
+        if (op == 4) {
+            emitter.alu_imm(OR, 8, RCX, FLAG_H);
+        }
+        emitter.mov(8, cpu_field(&cpu->regs.F), RCX);
+    }
+    if (op != 7) {
+        emitter.mov(8, reg8(7), RAX);
+    }
+}
+
+// Sets F from the host flags of an 8-bit op, keeping al. INC and DEC keep the carry flag.
+void Recompiler::emit_flags(bool subtract, bool keepCarry) {
+    emitter.lahf();
+    emitter.movzx_ah(RCX);
+    emitter.movzx(8, RCX, mem(R14, RCX, 1, 0));
+    if (keepCarry) {
+        emitter.alu_imm(AND, 32, RCX, FLAG_Z | FLAG_H);
+        emitter.movzx(8, RDX, cpu_field(&cpu->regs.F));
+        emitter.alu_imm(AND, 32, RDX, FLAG_C);
+        emitter.alu(OR, 32, RCX, RDX);
+    }
+    if (subtract) {
+        emitter.alu_imm(OR, 32, RCX, FLAG_N);
+    }
+    emitter.mov(8, cpu_field(&cpu->regs.F), RCX);
+}
+
+// Sets F from CF and optionally the zero flag of al after a rotate or shift
+void Recompiler::emit_shift_flags(bool zero) {
+    emitter.setcc(B, RCX);
+    emitter.shift(SHL, 8, RCX, 4);
+    if (zero) {
+        emitter.test(8, RAX, RAX);
+        emitter.setcc(E, RDX);
+        emitter.shift(SHL, 8, RDX, 7);
+        emitter.alu(OR, 8, RCX, RDX);
+    }
+    emitter.mov(8, cpu_field(&cpu->regs.F), RCX);
+}
+
+void Recompiler::emit_pop() {
+    Mem sp = reg16(3);
+    emit_tick();
+    emitter.movzx(16, RAX, sp);
+    emitter.inc(16, sp);
+    emit_read();
+    emitter.mov(32, R15, RAX);
+    emit_tick();
+    emitter.movzx(16, RAX, sp);
+    emitter.inc(16, sp);
+    emit_read();
+    emitter.shift(SHL, 32, RAX, 8);
+    emitter.alu(OR, 32, RAX, R15);
+}
+
+// Pushes r15w after the extra cycle of CPU::push
+void Recompiler::emit_push() {
+    Mem sp = reg16(3);
+    emit_tick();
+    emit_tick();
+    emitter.dec(16, sp);
+    emitter.movzx(16, RAX, sp);
+    emitter.mov(32, RDX, R15);
+    emitter.shift(SHR, 32, RDX, 8);
+    emit_write();
+    emit_tick();
+    emitter.dec(16, sp);
+    emitter.movzx(16, RAX, sp);
+    emitter.mov(32, RDX, R15);
+    emit_write();
+}
+
+// Helpers may stop the block by lowering the frame limit
+void Recompiler::emit_call_helper(u64 func) {
+    emitter.call(func);
+    emitter.mov(32, R13, self_field(&frameLimit));
+}
+
+void Recompiler::handle_events(Recompiler* self) {
+    try {
+        self->memory->emulate_events();
+        if (!self->can_run()) {
+            self->stop();
+        }
+    } catch (...) {
+        self->error = std::current_exception();
+        self->stop();
+    }
+}
+
+u8 Recompiler::read_slow(Recompiler* self, u16 addr) {
+    try {
+        return self->memory->read(addr);
+    } catch (...) {
+        self->error = std::current_exception();
+        self->stop();
+        return 0xFF;
+    }
+}
+
+// Writes can switch the banks the block was compiled from, request interrupts or change
+// code in ram, echo ram writes land in WRAM without going through the inline path
+void Recompiler::write_slow(Recompiler* self, u16 addr, u8 val) {
+    try {
+        self->memory->write(addr, val);
+        const Block& block = *self->curBlock;
+        if (block.inRam || !self->can_run() ||
+            self->memory->get_read_page(block.pc) + (block.pc & 0xFFF) != block.host) {
+            self->stop();
+        }
+    } catch (...) {
+        self->error = std::current_exception();
+        self->stop();
+    }
+}
+
+// Bytes holds the opcode and its immediates from the lowest byte
+void Recompiler::execute_op(Recompiler* self, u16 pc, u32 bytes) {
+    try {
+        CPU& cpu = *self->cpu;
+        u8 imm[2] = {(u8)(bytes >> 8), (u8)(bytes >> 16)};
+        u32 eventCycles = self->memory->get_event_cycles();
+        cpu.PC = (u16)(pc + 1);
+        cpu.immediates = imm;
+        cpu.execute((u8)bytes);
+        cpu.immediates = nullptr;
+        cpu.materialize_flags();
+        if (self->memory->get_event_cycles() != eventCycles && !self->can_run()) {
+            self->stop();
+        }
+    } catch (...) {
+        self->cpu->immediates = nullptr;
+        self->error = std::current_exception();
+        self->stop();
+    }
+}
+
+void Recompiler::check_poll_loop(Recompiler* self, u16 jumpAddr) {
+    try {
+        self->cpu->check_poll_loop(jumpAddr);
+    } catch (...) {
+        self->error = std::current_exception();
+        self->stop();
+    }
+}
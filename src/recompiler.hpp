@@ -0,0 +1,117 @@
+#pragma once
+
+#include <exception>
+#include <memory>
+#include <vector>
+
+#include "general.hpp"
+#include "x64_emitter.hpp"
+
+class CPU;
+class Memory;
+
+// Translates basic blocks of SM83 code into x86-64 code. Blocks tick the scheduler inline and run
+// until the end of the frame or until an event or access leaves a state native code doesn't
+// handle (interrupts, halting, stalls or a changed memory map), the CPU then continues with the
+// interpreter until the state allows native code again. Cycles and memory accesses happen in the
+// same order as in the interpreter.
+class Recompiler {
+public:
+    Recompiler(CPU& cpu, Memory& memory);
+
+    // Allocates the code buffer, returns false if native code can't run on this host
+    bool init();
+    void restart();
+
+    // Runs native blocks from the current PC, returns false if no cycle could be emulated
+    bool run();
+
+private:
+    static constexpr int MAX_BLOCK_OPS = 64;
+    static constexpr size_t BUFFER_SIZE = 16 << 20;
+    static constexpr size_t MAX_BLOCK_SIZE = 64 << 10;  // upper bound of a translated block
+    static constexpr u8 MAX_RECOMPILES = 4;  // ram blocks changed more often are interpreted
+    static constexpr u32 STOP = 0x80000000;  // frame limit which ends the block after the op
+
+    struct Block {
+        const u8* host;  // host memory of the first instruction, nullptr if the block is empty
+        u16 pc;
+        bool inRam;
+        u32 writeCount;  // write count of the ram chunk containing the block
+        u8 numRecompiles;
+        const u8* code;  // nullptr if the block is interpreted
+    };
+
+    bool can_run();
+    Block* lookup(u16 pc);
+
+    // Code generation, see recompiler.cpp for the register assignment
+    void emit_trampoline();
+    void emit_stubs();
+    const u8* compile(u16 pc, const u8* page, bool inRam);
+    bool compile_op(u16 pc, u8 opcode, const u8* imm);
+    void compile_cb(u8 cbOp);
+    void compile_fallback(u16 pc, u8 opcode, const u8* imm, bool endsBlock);
+
+    X64::Mem cpu_field(const void* field);
+    X64::Mem memory_field(const void* field);
+    X64::Mem self_field(const void* field);
+    X64::Mem reg8(u8 index);
+    X64::Mem reg16(u8 index);
+
+    void emit_prologue(u16 pc);
+    void emit_exit(u16 pc);
+    void emit_exit_dynamic();  // PC in eax
+    void emit_tick();
+    void emit_read();   // eax = addr -> eax
+    void emit_write();  // eax = addr, edx = val
+    void emit_read_const(u16 addr);
+    void emit_write_const(u16 addr);  // edx = val
+    X64::Cond emit_test_cond(u8 cc);
+    void emit_alu(u8 op);
+    void emit_flags(bool subtract, bool keepCarry);
+    void emit_shift_flags(bool zero);
+    void emit_pop();   // eax = popped value
+    void emit_push();  // r15d = pushed value
+    void emit_call_helper(u64 func);
+
+    // Called from native code, exceptions are stored and rethrown once the block has exited
+    static void handle_events(Recompiler* self);
+    static u8 read_slow(Recompiler* self, u16 addr);
+    static void write_slow(Recompiler* self, u16 addr, u8 val);
+    static void execute_op(Recompiler* self, u16 pc, u32 bytes);
+    static void check_poll_loop(Recompiler* self, u16 jumpAddr);
+    void stop() { frameLimit = STOP; }
+
+    CPU* cpu;
+    Memory* memory;
+
+    X64Emitter emitter;
+    using EnterFunc = void (*)(Recompiler* self, const u8* code);
+    EnterFunc enter;
+    size_t exitPos;
+    size_t eventsStub;
+    size_t readStub;
+    size_t writeStub;
+    size_t blocksStart;
+
+    u8 flagTable[0x100];  // lahf flags to SM83 Z, H and C
+    u32 frameLimit;
+    bool opFetched;  // the block exited after the opcode fetch cycle of the op at PC
+    std::exception_ptr error;
+
+    static constexpr size_t NUM_BLOCKS = 0x1000;
+    std::unique_ptr<Block[]> blocks;
+
+    // Exits of the block being compiled, patched to stubs storing their PC
+    struct Exit {
+        size_t patch;
+        u16 pc;
+        bool fetched;  // after the opcode fetch cycle
+    };
+    std::vector<Exit> exits;
+    bool compilingRam;
+    u16 compilingChunk;
+
+    Block* curBlock;
+};
@@ -0,0 +1,49 @@
+#include "scheduler.hpp"
+
+void Scheduler::restart() {
+    cycle = 0;
+    nextEventCycle = NEVER_CYCLE;
+    for (int i = 0; i < NUM_EVENTS; i++) {
+        eventCycles[i] = NEVER_CYCLE;
+        syncCycles[i] = 0;
+    }
+}
+
+void Scheduler::schedule(Event event, u32 idleCycles) {
+    if (idleCycles == NEVER) {
+        cancel(event);
+        return;
+    }
+    u64 eventCycle = cycle + idleCycles + 1;
+    eventCycles[(u8)event] = eventCycle;
+    if (eventCycle < nextEventCycle) {
+        nextEventCycle = eventCycle;
+    }
+}
+
+// A cancelled event may leave nextEventCycle early. This is harmless since due events are
+// checked individually and update_next_event() is called after every batch of events.
+void Scheduler::cancel(Event event) { eventCycles[(u8)event] = NEVER_CYCLE; }
+
+u32 Scheduler::get_idle_cycles() {
+    if (nextEventCycle <= cycle + 1) {
+        return 0;
+    }
+    u64 idleCycles = nextEventCycle - cycle - 1;
+    return idleCycles < NEVER ? (u32)idleCycles : NEVER - 1;
+}
+
+u32 Scheduler::sync(Event event) {
+    u32 elapsed = (u32)(cycle - syncCycles[(u8)event]);
+    syncCycles[(u8)event] = cycle;
+    return elapsed;
+}
+
+void Scheduler::update_next_event() {
+    nextEventCycle = NEVER_CYCLE;
+    for (int i = 0; i < NUM_EVENTS; i++) {
+        if (eventCycles[i] < nextEventCycle) {
+            nextEventCycle = eventCycles[i];
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "general.hpp"
+
+enum class Event : u8 {
+    CARTRIDGE,
+    DMA,
+    TIMER,
+    SERIAL,
+    PPU,
+    HDMA,
+    SPEED_SWITCH,
+    APU,  // never scheduled, only synced on access
+
+    NUM_EVENTS,
+};
+
+// Keeps track of the next machine cycle where each component has to be emulated. Components
+// in between events only count down, which is done in one jump when the component is synced.
+class Scheduler {
+public:
+    static constexpr u32 NEVER = 0xFFFFFFFF;  // Idle cycle count for a component with no event
+
+    void restart();
+
+    // Moves the master clock to the next machine cycle. Returns true if any event is due.
+    bool tick() { return ++cycle >= nextEventCycle; }
+    u64 get_cycle() { return cycle; }
+
+    // Returns the number of upcoming cycles with no due event, which can be skipped in one jump
+    u32 get_idle_cycles();
+    void skip(u32 numCycles) { cycle += numCycles; }
+
+    void schedule(Event event, u32 idleCycles);
+    void cancel(Event event);
+    bool is_due(Event event) { return eventCycles[(u8)event] <= cycle; }
+    bool is_scheduled(Event event) { return eventCycles[(u8)event] != NEVER_CYCLE; }
+
+    // Returns the number of cycles since the last sync and marks the component as up to date
+    u32 sync(Event event);
+
+    void update_next_event();
+
+private:
+    friend class Recompiler;  // Blocks tick the clock inline
+
+    static constexpr u64 NEVER_CYCLE = ~(u64)0;
+    static constexpr u8 NUM_EVENTS = (u8)Event::NUM_EVENTS;
+
+    u64 cycle;
+    u64 nextEventCycle;
+    u64 eventCycles[NUM_EVENTS];
+    u64 syncCycles[NUM_EVENTS];
+};
@@ -1,6 +1,7 @@
 #include "serial.hpp"
 
 #include "memory.hpp"
+#include "scheduler.hpp"
 
 Serial::Serial(Memory& memory) : memory(&memory) {
     sb = &memory.ref(IOReg::SB_REG);
@@ -30,6 +31,14 @@ void Serial::emulate_cycle() {
     }
 }
 
+u32 Serial::get_idle_cycles() { return cycles == 0 ? Scheduler::NEVER : cycles - 1u; }
+
+void Serial::skip_cycles(u32 numCycles) {
+    if (cycles > 0) {
+        cycles -= numCycles;
+    }
+}
+
 void Serial::trigger_transfer() {
     cycles = 116;  // Hack to pass mooneye serial
     bitsToTransfer = 8;
@@ -1,6 +1,7 @@
 #include "timer.hpp"
 
 #include "memory.hpp"
+#include "scheduler.hpp"
 
 Timer::Timer(Memory& memory) : memory(&memory) {
     div = &memory.ref(IOReg::DIV_REG);
@@ -49,6 +50,36 @@ void Timer::emulate_cycle() {
     try_trigger_tima();
 }
 
+// Number of upcoming cycles where emulate_cycle() would only increment the internal counter
+u32 Timer::get_idle_cycles() {
+    if (timaReloaded || timaIntrSchedule) {
+        return 0;
+    }
+    bool nextBitSet = ((cycles + 1) >> bitFreq) & enabled;
+    if (oldBitSet && !nextBitSet) {
+        return 0;
+    }
+    if (!enabled) {
+        return Scheduler::NEVER;
+    }
+    // Tima increments when the counter reaches the next multiple of the selected bit's period
+    u32 period = 2 << bitFreq;
+    u32 cyclesToEdge = period - (cycles & (period - 1));
+    if (cyclesToEdge == 1) {
+        cyclesToEdge += period;
+    }
+    return cyclesToEdge - 1;
+}
+
+void Timer::skip_cycles(u32 numCycles) {
+    if (numCycles == 0) {
+        return;
+    }
+    cycles += numCycles;
+    *div = cycles >> 6;
+    oldBitSet = (cycles >> bitFreq) & enabled;
+}
+
 void Timer::try_trigger_tima() {
     bool newBitSet = (cycles >> bitFreq) & enabled;
     if (!newBitSet && oldBitSet) {
@@ -12,6 +12,8 @@ public:
     void set_debugger(Debugger& debugger) { this->debugger = &debugger; }
 
     void emulate_cycle();
+    u32 get_idle_cycles();
+    void skip_cycles(u32 numCycles);
     void try_trigger_tima();
 
     void reset_div();
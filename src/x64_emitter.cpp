@@ -0,0 +1,269 @@
+#include "x64_emitter.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace X64;
+
+X64Emitter::~X64Emitter() {
+    if (!buffer) {
+        return;
+    }
+#ifdef _WIN32
+    VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+    munmap(buffer, size);
+#endif
+}
+
+bool X64Emitter::init(size_t bufferSize) {
+    if (buffer) {
+        return true;
+    }
+#ifdef _WIN32
+    void* mem = VirtualAlloc(nullptr, bufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+    if (!mem) {
+        return false;
+    }
+#else
+    void* mem = mmap(nullptr, bufferSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+#endif
+    buffer = static_cast<u8*>(mem);
+    size = bufferSize;
+    pos = 0;
+    return true;
+}
+
+void X64Emitter::mov(u8 width, Reg dst, Reg src) {
+    op_reg(width, width == 8 ? 0x88 : 0x89, src, dst);
+}
+
+void X64Emitter::mov(u8 width, Reg dst, const Mem& src) {
+    op_mem(width, width == 8 ? 0x8A : 0x8B, dst, src);
+}
+
+void X64Emitter::mov(u8 width, const Mem& dst, Reg src) {
+    op_mem(width, width == 8 ? 0x88 : 0x89, src, dst);
+}
+
+void X64Emitter::mov_imm(u8 width, Reg dst, u64 imm) {
+    prefix(width, 0, 0, dst);
+    emit8((u8)((width == 8 ? 0xB0 : 0xB8) + (dst & 7)));
+    if (width == 64) {
+        emit64(imm);
+    } else {
+        emit_imm(width, (u32)imm);
+    }
+}
+
+void X64Emitter::mov_imm(u8 width, const Mem& dst, u32 imm) {
+    op_mem(width, width == 8 ? 0xC6 : 0xC7, 0, dst);
+    emit_imm(width == 64 ? 32 : width, imm);
+}
+
+void X64Emitter::movzx(u8 srcWidth, Reg dst, Reg src) {
+    op_reg(32, srcWidth == 8 ? 0x0FB6 : 0x0FB7, dst, src);
+}
+
+void X64Emitter::movzx(u8 srcWidth, Reg dst, const Mem& src) {
+    op_mem(32, srcWidth == 8 ? 0x0FB6 : 0x0FB7, dst, src);
+}
+
+// ah is only encodable without a rex prefix
+void X64Emitter::movzx_ah(Reg dst) {
+    opcode(0x0FB6);
+    emit8((u8)(0xC4 | (dst & 7) << 3));
+}
+
+void X64Emitter::alu(AluOp op, u8 width, Reg dst, Reg src) {
+    op_reg(width, (u32)(op << 3 | (width == 8 ? 0x00 : 0x01)), src, dst);
+}
+
+void X64Emitter::alu(AluOp op, u8 width, Reg dst, const Mem& src) {
+    op_mem(width, (u32)(op << 3 | (width == 8 ? 0x02 : 0x03)), dst, src);
+}
+
+void X64Emitter::alu(AluOp op, u8 width, const Mem& dst, Reg src) {
+    op_mem(width, (u32)(op << 3 | (width == 8 ? 0x00 : 0x01)), src, dst);
+}
+
+void X64Emitter::alu_imm(AluOp op, u8 width, Reg dst, u32 imm) {
+    bool imm8 = width != 8 && (s32)imm >= -128 && (s32)imm <= 127;
+    op_reg(width, width == 8 ? 0x80 : (imm8 ? 0x83 : 0x81), op, dst);
+    emit_imm(imm8 ? 8 : (width == 64 ? 32 : width), imm);
+}
+
+void X64Emitter::alu_imm(AluOp op, u8 width, const Mem& dst, u32 imm) {
+    bool imm8 = width != 8 && (s32)imm >= -128 && (s32)imm <= 127;
+    op_mem(width, width == 8 ? 0x80 : (imm8 ? 0x83 : 0x81), op, dst);
+    emit_imm(imm8 ? 8 : (width == 64 ? 32 : width), imm);
+}
+
+void X64Emitter::test(u8 width, Reg a, Reg b) { op_reg(width, width == 8 ? 0x84 : 0x85, b, a); }
+
+void X64Emitter::test_imm(u8 width, Reg dst, u32 imm) {
+    op_reg(width, width == 8 ? 0xF6 : 0xF7, 0, dst);
+    emit_imm(width == 64 ? 32 : width, imm);
+}
+
+void X64Emitter::test_imm(u8 width, const Mem& dst, u32 imm) {
+    op_mem(width, width == 8 ? 0xF6 : 0xF7, 0, dst);
+    emit_imm(width == 64 ? 32 : width, imm);
+}
+
+void X64Emitter::inc(u8 width, Reg dst) { op_reg(width, width == 8 ? 0xFE : 0xFF, 0, dst); }
+
+void X64Emitter::inc(u8 width, const Mem& dst) { op_mem(width, width == 8 ? 0xFE : 0xFF, 0, dst); }
+
+void X64Emitter::dec(u8 width, Reg dst) { op_reg(width, width == 8 ? 0xFE : 0xFF, 1, dst); }
+
+void X64Emitter::dec(u8 width, const Mem& dst) { op_mem(width, width == 8 ? 0xFE : 0xFF, 1, dst); }
+
+void X64Emitter::shift(ShiftOp op, u8 width, Reg dst, u8 count) {
+    if (count == 1) {
+        op_reg(width, width == 8 ? 0xD0 : 0xD1, op, dst);
+    } else {
+        op_reg(width, width == 8 ? 0xC0 : 0xC1, op, dst);
+        emit8(count);
+    }
+}
+
+void X64Emitter::setcc(Cond cond, Reg dst) { op_reg(8, 0x0F90u | cond, 0, dst); }
+
+void X64Emitter::lahf() { emit8(0x9F); }
+
+void X64Emitter::push(Reg reg) {
+    prefix(32, 0, 0, reg);
+    emit8((u8)(0x50 + (reg & 7)));
+}
+
+void X64Emitter::pop(Reg reg) {
+    prefix(32, 0, 0, reg);
+    emit8((u8)(0x58 + (reg & 7)));
+}
+
+void X64Emitter::ret() { emit8(0xC3); }
+
+void X64Emitter::call(u64 func) {
+    mov_imm(64, RAX, func);
+    op_reg(32, 0xFF, 2, RAX);
+}
+
+void X64Emitter::call_to(size_t target) {
+    emit8(0xE8);
+    emit_rel32(target);
+}
+
+void X64Emitter::jmp(Reg target) { op_reg(32, 0xFF, 4, target); }
+
+void X64Emitter::jmp_to(size_t target) {
+    emit8(0xE9);
+    emit_rel32(target);
+}
+
+void X64Emitter::jcc_to(Cond cond, size_t target) {
+    opcode(0x0F80u | cond);
+    emit_rel32(target);
+}
+
+size_t X64Emitter::jmp() {
+    emit8(0xE9);
+    pos += 4;
+    return pos - 4;
+}
+
+size_t X64Emitter::jcc(Cond cond) {
+    opcode(0x0F80u | cond);
+    pos += 4;
+    return pos - 4;
+}
+
+void X64Emitter::bind(size_t patch) {
+    size_t curPos = pos;
+    pos = patch;
+    emit_rel32(curPos);
+    pos = curPos;
+}
+
+void X64Emitter::emit16(u16 val) {
+    emit8(val & 0xFF);
+    emit8(val >> 8);
+}
+
+void X64Emitter::emit32(u32 val) {
+    emit16(val & 0xFFFF);
+    emit16((u16)(val >> 16));
+}
+
+void X64Emitter::emit64(u64 val) {
+    emit32(val & 0xFFFFFFFF);
+    emit32((u32)(val >> 32));
+}
+
+void X64Emitter::emit_imm(u8 width, u32 imm) {
+    if (width == 8) {
+        emit8((u8)imm);
+    } else if (width == 16) {
+        emit16((u16)imm);
+    } else {
+        emit32(imm);
+    }
+}
+
+// Displacements are relative to the end of the instruction, which ends with them
+void X64Emitter::emit_rel32(size_t target) { emit32((u32)(s32)((s64)target - (s64)(pos + 4))); }
+
+void X64Emitter::prefix(u8 width, u8 reg, u8 index, u8 base) {
+    if (width == 16) {
+        emit8(0x66);
+    }
+    u8 rex = (u8)((width == 64) << 3 | (reg & 8) >> 1 | (index & 8) >> 2 | (base & 8) >> 3);
+    if (rex) {
+        emit8(0x40 | rex);
+    }
+}
+
+void X64Emitter::opcode(u32 op) {
+    if (op > 0xFF) {
+        emit8((u8)(op >> 8));
+    }
+    emit8(op & 0xFF);
+}
+
+void X64Emitter::op_reg(u8 width, u32 op, u8 reg, Reg rm) {
+    prefix(width, reg, 0, rm);
+    opcode(op);
+    emit8((u8)(0xC0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+void X64Emitter::op_mem(u8 width, u32 op, u8 reg, const Mem& rm) {
+    prefix(width, reg, rm.index == RSP ? 0 : rm.index, rm.base);
+    opcode(op);
+
+    u8 base = rm.base & 7;
+    bool sib = rm.index != RSP || base == RSP;
+    u8 mod = 2;
+    if (rm.disp == 0 && base != RBP) {
+        mod = 0;
+    } else if (rm.disp >= -128 && rm.disp <= 127) {
+        mod = 1;
+    }
+    emit8((u8)(mod << 6 | (reg & 7) << 3 | (sib ? (u8)RSP : base)));
+    if (sib) {
+        u8 scale = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+        emit8((u8)(scale << 6 | (rm.index & 7) << 3 | base));
+    }
+    if (mod == 1) {
+        emit8((u8)rm.disp);
+    } else if (mod == 2) {
+        emit32((u32)rm.disp);
+    }
+}
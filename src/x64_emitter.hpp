@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+
+#include "general.hpp"
+
+namespace X64 {
+// Registers in the order of their encoding
+enum Reg : u8 { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+enum Cond : u8 { O, NO, B, AE, E, NE, BE, A, S, NS, P, NP, L, GE, LE, G };
+
+// Arithmetic instructions in the order of their opcode extension
+enum AluOp : u8 { ADD, OR, ADC, SBB, AND, SUB, XOR, CMP };
+
+enum ShiftOp : u8 { ROL, ROR, RCL, RCR, SHL, SHR, SAR = 7 };
+
+// [base + index * scale + disp], an index of RSP means no index
+struct Mem {
+    Reg base;
+    s32 disp;
+    Reg index;
+    u8 scale;
+};
+inline Mem mem(Reg base, s32 disp) { return {base, disp, RSP, 1}; }
+inline Mem mem(Reg base, Reg index, u8 scale, s32 disp) { return {base, disp, index, scale}; }
+}  // namespace X64
+
+// Encodes the x86-64 instructions used by the recompiler into a buffer of executable memory.
+// Widths are operand sizes in bits. Byte registers are limited to al, cl, dl, bl and r8b-r15b.
+class X64Emitter {
+public:
+    ~X64Emitter();
+
+    // Allocates the buffer, returns false if the host doesn't allow executable memory
+    bool init(size_t bufferSize);
+    bool is_initialized() { return buffer != nullptr; }
+
+    const u8* get_code(size_t offset) { return buffer + offset; }
+    size_t get_pos() { return pos; }
+    size_t get_free() { return size - pos; }
+    void rewind(size_t offset) { pos = offset; }
+
+    void mov(u8 width, X64::Reg dst, X64::Reg src);
+    void mov(u8 width, X64::Reg dst, const X64::Mem& src);
+    void mov(u8 width, const X64::Mem& dst, X64::Reg src);
+    void mov_imm(u8 width, X64::Reg dst, u64 imm);
+    void mov_imm(u8 width, const X64::Mem& dst, u32 imm);
+    void movzx(u8 srcWidth, X64::Reg dst, X64::Reg src);
+    void movzx(u8 srcWidth, X64::Reg dst, const X64::Mem& src);
+    void movzx_ah(X64::Reg dst);
+
+    void alu(X64::AluOp op, u8 width, X64::Reg dst, X64::Reg src);
+    void alu(X64::AluOp op, u8 width, X64::Reg dst, const X64::Mem& src);
+    void alu(X64::AluOp op, u8 width, const X64::Mem& dst, X64::Reg src);
+    void alu_imm(X64::AluOp op, u8 width, X64::Reg dst, u32 imm);
+    void alu_imm(X64::AluOp op, u8 width, const X64::Mem& dst, u32 imm);
+    void test(u8 width, X64::Reg a, X64::Reg b);
+    void test_imm(u8 width, X64::Reg dst, u32 imm);
+    void test_imm(u8 width, const X64::Mem& dst, u32 imm);
+    void inc(u8 width, X64::Reg dst);
+    void inc(u8 width, const X64::Mem& dst);
+    void dec(u8 width, X64::Reg dst);
+    void dec(u8 width, const X64::Mem& dst);
+    void shift(X64::ShiftOp op, u8 width, X64::Reg dst, u8 count);
+    void setcc(X64::Cond cond, X64::Reg dst);
+    void lahf();
+
+    void push(X64::Reg reg);
+    void pop(X64::Reg reg);
+    void ret();
+    void call(u64 func);  // Through rax
+    void call_to(size_t target);
+    void jmp(X64::Reg target);
+    void jmp_to(size_t target);
+    void jcc_to(X64::Cond cond, size_t target);
+
+    // Forward jumps return the position of their displacement, which is patched by bind
+    size_t jmp();
+    size_t jcc(X64::Cond cond);
+    void bind(size_t patch);
+
+private:
+    void emit8(u8 val) { buffer[pos++] = val; }
+    void emit16(u16 val);
+    void emit32(u32 val);
+    void emit64(u64 val);
+    void emit_imm(u8 width, u32 imm);
+    void emit_rel32(size_t target);
+
+    void prefix(u8 width, u8 reg, u8 index, u8 base);
+    void opcode(u32 op);
+    void op_reg(u8 width, u32 op, u8 reg, X64::Reg rm);
+    void op_mem(u8 width, u32 op, u8 reg, const X64::Mem& rm);
+
+    u8* buffer = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+};
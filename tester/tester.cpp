@@ -1,8 +1,12 @@
 #include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <utility>
 #include <vector>
 
+#include "apu.hpp"
+#include "blip_buffer.hpp"
 #include "game_boy.hpp"
 
 namespace {
@@ -75,11 +79,63 @@ void test_dir(const std::filesystem::path& file, const std::vector<std::string>&
         numTests += files.size();
     }
 }
+
+// Frames whose samples are never read, e.g. headless emulate_frame() calls, must leave the
+// integrated output at the level of the channel once samples are read again
+bool test_blip_unread_samples() {
+    constexpr double CLOCKS_PER_SAMPLE = 4194304.0 / 48000;
+    constexpr u32 FRAME_CLOCKS = 70224;
+    constexpr s32 SCALE = 64;
+    static BlipBuffer buffer;
+    buffer.restart(CLOCKS_PER_SAMPLE);
+    ChannelOutput output = {&buffer, nullptr, SCALE, 0};
+    u8 level = 0;
+
+    // Each frame ends at a different level
+    for (u32 frame = 0; frame < 16; frame++) {
+        for (u32 clock = 0, step = 0; clock < FRAME_CLOCKS; clock += 97, step++) {
+            output.set_level(level, (u8)((frame + step) & 0xF), clock);
+        }
+        buffer.end_frame(FRAME_CLOCKS);
+    }
+    // Lets the last step settle before reading everything
+    buffer.end_frame((u32)(BlipBuffer::KERNEL_WIDTH * 2 * CLOCKS_PER_SAMPLE));
+    std::vector<s16> samples(buffer.get_samples_avail());
+    buffer.read_samples(samples.data(), (u32)samples.size(), 1);
+    return !samples.empty() && samples.back() == level * SCALE;
+}
+
+void test_units() {
+    const std::pair<const char*, bool (*)()> tests[] = {
+        {"blip buffer unread samples", test_blip_unread_samples},
+    };
+    std::cout << " --- unit tests --- " << std::endl;
+    for (size_t i = 0; i < std::size(tests); i++) {
+        std::cout << "[0" << i + 1 << "/" << std::size(tests) << "] ";
+        if (tests[i].second()) {
+            std::cout << "x PASSED: " << tests[i].first << std::endl;
+            numPassed++;
+        } else {
+            std::cout << "  FAILED: " << tests[i].first << std::endl;
+        }
+    }
+    numTests += std::size(tests);
+}
 }  // namespace
 
 int main(int argc, char** argv) {
     gameboy.set_debugger(debugger);
+    if (argc > 1 && !strcmp(argv[1], "--interpreter")) {
+        gameboy.set_cpu_backend(CPUBackend::INTERPRETER);
+        argc--;
+        argv++;
+    } else if (argc > 1 && !strcmp(argv[1], "--recompiler")) {
+        gameboy.set_cpu_backend(CPUBackend::RECOMPILER);
+        argc--;
+        argv++;
+    }
     try {
+        test_units();
         if (argc == 1) {
             const std::vector<std::string> testRomPaths = {
                 // "SameSuite\\apu\\channel_1",
@@ -99,8 +155,9 @@ int main(int argc, char** argv) {
         } else if (argc == 2) {
             test_dir(std::filesystem::path(argv[1]), std::vector<std::string>());
         } else {
-            std::cout << "Usage: gbemu-tester [optional test directory]\tRuns all tests when no "
-                         "args provided"
+            std::cout << "Usage: gbemu-tester [--interpreter|--recompiler] [optional test "
+                         "directory]\tRuns all tests when no directory is provided, --interpreter "
+                         "disables the block cache, --recompiler runs native x86-64 code"
                       << std::endl;
             return -1;
         }